@@ -11,21 +11,40 @@
 
 #include "ArrayList.h"
 
+// address of the item at index in the buffer
+static char* alist_at(ArrayList* arrayList, int index){
+    return (char*)arrayList->arr + (size_t)index * arrayList->itemByteSize;
+}
+
 ArrayList* alist_initialize(int maxSize, int itemByteSize, char* datatype){
     ArrayList *arrayList = calloc(1, sizeof(ArrayList));
+    if(arrayList == NULL){
+        return NULL;
+    }
+
+    if(maxSize < 1){
+        maxSize = 1;
+    }
+
     arrayList->currSize = 0;
     arrayList->maxSize = maxSize;
     arrayList->itemByteSize = itemByteSize;
-    arrayList->datatype = calloc(1, sizeof(char*));
+    arrayList->datatype = malloc(strlen(datatype) + 1);
+    arrayList->arr = malloc((size_t)maxSize * itemByteSize);
 
-    memcpy(arrayList->datatype, datatype, sizeof(char*));
+    if(arrayList->datatype == NULL || arrayList->arr == NULL){
+        free(arrayList->datatype);
+        free(arrayList->arr);
+        free(arrayList);
+        return NULL;
+    }
 
-    arrayList->arr = calloc(maxSize, sizeof(void*));
+    strcpy(arrayList->datatype, datatype);
 
     return arrayList;
 }
 
-// TODO: What would cause this function to return false?
+// Returns false if the list or item is NULL, or the list could not grow to fit the item
 bool alist_add(ArrayList* arrayList, void* item){
     if(item == NULL){
         printf("Invalid item passed in\n");
@@ -37,27 +56,16 @@ bool alist_add(ArrayList* arrayList, void* item){
         return false;
     }
 
-    // if arraylist still has space, add the item
-    if(arrayList->currSize < arrayList->maxSize){
-        arrayList->arr[arrayList->currSize] = calloc(1, arrayList->itemByteSize);
-        memcpy(arrayList->arr[arrayList->currSize], item, arrayList->itemByteSize);
-        arrayList->currSize++;
-
-        // Test code:
-        // printf("%d\n", *(int*)arrayList->arr[arrayList->currSize-1]);
-        return true;
-    } else{
-        // resize the arraylist and add it
-        printf("Resizing...\n");
+    // resize the arraylist if it is out of space
+    if(arrayList->currSize == arrayList->maxSize){
         bool resizeSuccess = alist_resize(arrayList);
         if(!resizeSuccess){ return false;}
+    }
 
-        arrayList->arr[arrayList->currSize] = calloc(1, arrayList->itemByteSize);
-        memcpy(arrayList->arr[arrayList->currSize], item, arrayList->itemByteSize);
-        arrayList->currSize++;
+    memcpy(alist_at(arrayList, arrayList->currSize), item, arrayList->itemByteSize);
+    arrayList->currSize++;
 
-        return true;
-    }
+    return true;
 }
 
 bool alist_add_at(ArrayList* arrayList, int index, void* item){
@@ -66,7 +74,8 @@ bool alist_add_at(ArrayList* arrayList, int index, void* item){
         return false;
     }
 
-    if(index < 0 || index >= arrayList->currSize){
+    // index == currSize appends
+    if(index < 0 || index > arrayList->currSize){
         printf("Invalid index\n");
         return false;
     }
@@ -76,9 +85,7 @@ bool alist_add_at(ArrayList* arrayList, int index, void* item){
         return false;
     }
 
-    if(arrayList->currSize + 1 >= arrayList->maxSize){
-        // resize
-        printf("Resizing (add at)..\n");
+    if(arrayList->currSize == arrayList->maxSize){
         bool resizingSuccess = alist_resize(arrayList);
         if(!resizingSuccess){
             printf("Resizing failed\n");
@@ -86,26 +93,37 @@ bool alist_add_at(ArrayList* arrayList, int index, void* item){
         }
     }
 
-    // go in reverse
-    arrayList->arr[arrayList->currSize] = calloc(1, arrayList->itemByteSize);
-    for(int i = arrayList->currSize; i > index; i--){
-        memcpy(arrayList->arr[i], arrayList->arr[i - 1], arrayList->itemByteSize);
-    }
-    memcpy(arrayList->arr[index], item, arrayList->itemByteSize);
+    // shift the tail of the list up by one in a single move
+    memmove(alist_at(arrayList, index + 1), alist_at(arrayList, index),
+            (size_t)(arrayList->currSize - index) * arrayList->itemByteSize);
+    memcpy(alist_at(arrayList, index), item, arrayList->itemByteSize);
 
     arrayList->currSize++;
     return true;
 }
 
+// append count items stored back to back at items
+bool alist_add_all(ArrayList* arrayList, void* items, int count){
+    if(arrayList == NULL || items == NULL || count < 0){
+        return false;
+    }
+
+    if(!alist_reserve(arrayList, arrayList->currSize + count)){
+        return false;
+    }
+
+    memcpy(alist_at(arrayList, arrayList->currSize), items, (size_t)count * arrayList->itemByteSize);
+    arrayList->currSize += count;
+
+    return true;
+}
+
+// empty the list, the buffer is kept for reuse
 void alist_clear(ArrayList* arrayList){
-    printf("Clearing arraylist\n");
     if(arrayList == NULL){
         return;
     }
 
-    for(int i = 0; i < arrayList->currSize; i++){
-        free(arrayList->arr[i]);
-    }
     arrayList->currSize = 0;
 }
 
@@ -117,7 +135,7 @@ void* alist_get(ArrayList* arr, int index){
         return NULL;
     }
 
-    return arr->arr[index];
+    return alist_at(arr, index);
 }
 
 int alist_index_of(ArrayList* arr, void* item){
@@ -126,7 +144,7 @@ int alist_index_of(ArrayList* arr, void* item){
     }
 
     for(int i = 0; i < arr->currSize; i++){
-        if(memcmp(arr->arr[i], item, arr->itemByteSize) == 0){
+        if(memcmp(alist_at(arr, i), item, arr->itemByteSize) == 0){
             return i;
         }
     }
@@ -134,7 +152,7 @@ int alist_index_of(ArrayList* arr, void* item){
     return -1;
 }
 
-// TODO: Feels like I should use realloc instead of calloc here
+// remove the item at index and return a copy of it, which the caller must free
 void* alist_remove(ArrayList* arr, int index){
 
     if(arr == NULL){
@@ -145,36 +163,65 @@ void* alist_remove(ArrayList* arr, int index){
         return NULL;
     }
 
-    // create a new pointer so that we can free the pointer in the array
-    void *removedItem = calloc(1, arr->itemByteSize);
+    void *removedItem = malloc(arr->itemByteSize);
+    if(removedItem == NULL){
+        return NULL;
+    }
 
-    // removing the element
-    memcpy(removedItem, arr->arr[index], arr->itemByteSize);
-    arr->arr[index] = calloc(1, arr->itemByteSize);
+    alist_remove_into(arr, index, removedItem);
+    return removedItem;
+}
 
-    // moving all elements to the left
-    for(int i = index; i < arr->currSize - 1; i++){
-        memcpy(arr->arr[i], arr->arr[i + 1], arr->itemByteSize);
-        arr->arr[i + 1] = calloc(1, arr->itemByteSize);
+// remove the item at index, copying it into item first unless item is NULL
+bool alist_remove_into(ArrayList* arr, int index, void* item){
+    if(arr == NULL){
+        return false;
     }
 
-    // freeing the ptr
-    free(arr->arr[arr->currSize-1]);
+    if(index < 0 || index >= arr->currSize){
+        return false;
+    }
 
-    // reducing the size by 1
-    arr->currSize -= 1;
+    if(item != NULL){
+        memcpy(item, alist_at(arr, index), arr->itemByteSize);
+    }
 
-    return removedItem;
+    return alist_remove_range(arr, index, 1);
 }
 
-bool alist_destroy(ArrayList* arrayList){
-    printf("Destroying arraylist\n");
-    if(arrayList == NULL){
+// remove count items starting at index
+bool alist_remove_range(ArrayList* arr, int index, int count){
+    if(arr == NULL){
         return false;
     }
 
-    for(int i = 0; i < arrayList->currSize; i++){
-        free(arrayList->arr[i]);
+    if(index < 0 || count < 0 || count > arr->currSize - index){
+        return false;
+    }
+
+    // moving all elements after the range to the left in a single move
+    memmove(alist_at(arr, index), alist_at(arr, index + count),
+            (size_t)(arr->currSize - index - count) * arr->itemByteSize);
+
+    arr->currSize -= count;
+
+    return true;
+}
+
+// drop the items from index size on, the buffer is kept for reuse
+void alist_truncate(ArrayList* arrayList, int size){
+    if(arrayList == NULL){
+        return;
+    }
+
+    if(size >= 0 && size < arrayList->currSize){
+        arrayList->currSize = size;
+    }
+}
+
+bool alist_destroy(ArrayList* arrayList){
+    if(arrayList == NULL){
+        return false;
     }
 
     free(arrayList->arr);
@@ -184,25 +231,75 @@ bool alist_destroy(ArrayList* arrayList){
     return true;
 }
 
+// double the capacity of the list
 bool alist_resize(ArrayList* arrayList){
     if(arrayList == NULL){
         return false;
     }
-    arrayList->arr = realloc(arrayList->arr, arrayList->maxSize * sizeof(void*) * 2);
 
-    if(arrayList->arr == NULL){
+    return alist_reserve(arrayList, arrayList->maxSize * 2);
+}
+
+// make sure the list has room for at least capacity items, growing geometrically
+bool alist_reserve(ArrayList* arrayList, int capacity){
+    if(arrayList == NULL){
         return false;
     }
 
-    arrayList->maxSize *= 2;
+    if(capacity <= arrayList->maxSize){
+        return true;
+    }
+
+    int newSize = arrayList->maxSize;
+    while(newSize < capacity){
+        newSize *= 2;
+    }
+
+    void* arr = realloc(arrayList->arr, (size_t)newSize * arrayList->itemByteSize);
+    if(arr == NULL){
+        return false;
+    }
+
+    arrayList->arr = arr;
+    arrayList->maxSize = newSize;
     return true;
 }
 
+// release the capacity that is not in use
+bool alist_shrink(ArrayList* arrayList){
+    if(arrayList == NULL){
+        return false;
+    }
+
+    int newSize = arrayList->currSize > 0 ? arrayList->currSize : 1;
+    if(newSize == arrayList->maxSize){
+        return true;
+    }
+
+    void* arr = realloc(arrayList->arr, (size_t)newSize * arrayList->itemByteSize);
+    if(arr == NULL){
+        return false;
+    }
+
+    arrayList->arr = arr;
+    arrayList->maxSize = newSize;
+    return true;
+}
+
+// sort the items in place with a qsort style comparison function
+void alist_sort(ArrayList* arrayList, int (*compare)(const void*, const void*)){
+    if(arrayList == NULL || compare == NULL){
+        return;
+    }
+
+    qsort(arrayList->arr, arrayList->currSize, arrayList->itemByteSize, compare);
+}
+
 void alist_print(ArrayList* arrayList){
     printf("ArrayList contents:\n");
 
     for(int i = 0; i < arrayList->currSize; i++){
-        printf("%d ", *(int*)arrayList->arr[i]);
+        printf("%d ", *(int*)alist_at(arrayList, i));
     }
 
     printf("\n");
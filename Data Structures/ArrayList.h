@@ -17,8 +17,11 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+// Items are stored by value, back to back in one buffer of maxSize items.
+// Pointers returned by alist_get point into that buffer, so they are only
+// valid until the list is next resized or items are inserted or removed.
 typedef struct _AList{
-    void ** arr;
+    void* arr;
     int currSize;
     int maxSize;
     int itemByteSize;
@@ -28,12 +31,19 @@ typedef struct _AList{
 ArrayList* alist_initialize(int, int, char*);
 bool alist_add(ArrayList*, void*);
 bool alist_add_at(ArrayList*, int, void*);
+bool alist_add_all(ArrayList*, void*, int);
 void alist_clear(ArrayList*);
 void* alist_get(ArrayList*, int);
 int alist_index_of(ArrayList*, void*);
 void* alist_remove(ArrayList*, int);
+bool alist_remove_into(ArrayList*, int, void*);
+bool alist_remove_range(ArrayList*, int, int);
+void alist_truncate(ArrayList*, int);
 bool alist_destroy(ArrayList*);
 bool alist_resize(ArrayList*);
+bool alist_reserve(ArrayList*, int);
+bool alist_shrink(ArrayList*);
+void alist_sort(ArrayList*, int (*)(const void*, const void*));
 
 // test
 void alist_print(ArrayList*);
@@ -0,0 +1,139 @@
+/*H**********************************************************************
+* FILENAME :        ConcurrentMap.c
+*
+* DESCRIPTION :
+*       Implementation of a read-mostly concurrent hash map with unsigned long keys
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+#include <string.h>
+#include "ConcurrentMap.h"
+
+// the slot a key's probe sequence starts at, taking the high bits of a multiplicative hash
+static int cm_slot(CMTable* table, unsigned long key){
+    unsigned long hash = key * 0x9E3779B97F4A7C15UL;
+    return (int)(hash >> 32) & (table->size - 1);
+}
+
+// allocate an empty table with the given number of slots
+static CMTable* cm_table_new(int size, int itemByteSize){
+    CMTable* table = malloc(sizeof(CMTable));
+    if(table == NULL) return NULL;
+
+    table->keys = malloc(size * sizeof(*table->keys));
+    table->items = malloc((size_t)size * itemByteSize);
+    if(table->keys == NULL || table->items == NULL){
+        free(table->keys);
+        free(table->items);
+        free(table);
+        return NULL;
+    }
+    for(int i = 0; i < size; i++) atomic_init(&table->keys[i], 0);
+
+    table->size = size;
+    table->prev = NULL;
+    return table;
+}
+
+// Create an empty map that holds capacity items before it has to grow
+ConcurrentMap* cm_init(int capacity, int itemByteSize){
+    ConcurrentMap* map = malloc(sizeof(ConcurrentMap));
+    if(map == NULL) return NULL;
+
+    // tables are kept at most half full so probe sequences stay short
+    int size = 16;
+    while(size < 2 * capacity) size *= 2;
+
+    CMTable* table = cm_table_new(size, itemByteSize);
+    if(table == NULL){
+        free(map);
+        return NULL;
+    }
+    atomic_init(&map->table, table);
+    pthread_mutex_init(&map->lock, NULL);
+    map->itemByteSize = itemByteSize;
+    map->count = 0;
+    return map;
+}
+
+// copy an item into the first free slot of its probe sequence and publish the key
+static void cm_place(CMTable* table, unsigned long key, void* item, int itemByteSize){
+    int i = cm_slot(table, key);
+    while(atomic_load_explicit(&table->keys[i], memory_order_relaxed) != 0){
+        i = (i + 1) & (table->size - 1);
+    }
+    memcpy(table->items + (size_t)i * itemByteSize, item, itemByteSize);
+    atomic_store_explicit(&table->keys[i], key, memory_order_release);
+}
+
+// add a copy of an item under a key, which must not be 0. Returns false if the key is
+// already in the map or the map could not grow
+bool cm_put(ConcurrentMap* map, unsigned long key, void* item){
+    if(map == NULL || key == 0) return false;
+
+    pthread_mutex_lock(&map->lock);
+    if(cm_get(map, key) != NULL){
+        pthread_mutex_unlock(&map->lock);
+        return false;
+    }
+
+    CMTable* table = atomic_load_explicit(&map->table, memory_order_relaxed);
+    if(2 * (map->count + 1) > table->size){
+        // fill a bigger table before publishing it, readers keep using the old one until then
+        CMTable* bigger = cm_table_new(table->size * 2, map->itemByteSize);
+        if(bigger == NULL){
+            pthread_mutex_unlock(&map->lock);
+            return false;
+        }
+        for(int i = 0; i < table->size; i++){
+            unsigned long k = atomic_load_explicit(&table->keys[i], memory_order_relaxed);
+            if(k != 0){
+                cm_place(bigger, k, table->items + (size_t)i * map->itemByteSize, map->itemByteSize);
+            }
+        }
+        bigger->prev = table;
+        atomic_store_explicit(&map->table, bigger, memory_order_release);
+        table = bigger;
+    }
+
+    cm_place(table, key, item, map->itemByteSize);
+    map->count++;
+    pthread_mutex_unlock(&map->lock);
+    return true;
+}
+
+// Look up a key without locking. Returns a pointer to the map's copy of the item, or NULL
+// if the key is not in the map
+void* cm_get(ConcurrentMap* map, unsigned long key){
+    if(map == NULL || key == 0) return NULL;
+
+    CMTable* table = atomic_load_explicit(&map->table, memory_order_acquire);
+    int i = cm_slot(table, key);
+    for(;;){
+        unsigned long k = atomic_load_explicit(&table->keys[i], memory_order_acquire);
+        if(k == key) return table->items + (size_t)i * map->itemByteSize;
+        if(k == 0) return NULL;
+        i = (i + 1) & (table->size - 1);
+    }
+}
+
+int cm_size(ConcurrentMap* map){
+    if(map == NULL) return 0;
+    return map->count;
+}
+
+bool cm_destroy(ConcurrentMap* map){
+    if(map == NULL) return false;
+
+    CMTable* table = atomic_load(&map->table);
+    while(table != NULL){
+        CMTable* prev = table->prev;
+        free(table->keys);
+        free(table->items);
+        free(table);
+        table = prev;
+    }
+    pthread_mutex_destroy(&map->lock);
+    free(map);
+    return true;
+}
@@ -0,0 +1,42 @@
+/*H**********************************************************************
+* FILENAME :        ConcurrentMap.h
+*
+* DESCRIPTION :
+*       Implementation of a read-mostly concurrent hash map with unsigned long keys
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+
+#ifndef TEST_CONCURRENTMAP_H
+#define TEST_CONCURRENTMAP_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Open addressing table of keys and copies of their items. A key is published after its
+// item has been copied in, so readers see complete items without taking a lock.
+typedef struct _CMTable{
+    int size;                       // number of slots, a power of two
+    _Atomic unsigned long* keys;    // 0 marks a free slot
+    char* items;
+    struct _CMTable* prev;          // the table this one replaced
+}CMTable;
+
+// Writers take the lock, readers never do. Items are never removed or changed once added,
+// and a table that is outgrown is kept until the map is destroyed, since a reader may
+// still be looking through it.
+typedef struct _ConcurrentMap{
+    _Atomic(CMTable*) table;
+    pthread_mutex_t lock;
+    int itemByteSize;
+    int count;
+}ConcurrentMap;
+
+ConcurrentMap* cm_init(int capacity, int itemByteSize);
+bool cm_put(ConcurrentMap* map, unsigned long key, void* item);
+void* cm_get(ConcurrentMap* map, unsigned long key);
+int cm_size(ConcurrentMap* map);
+bool cm_destroy(ConcurrentMap* map);
+
+#endif //TEST_CONCURRENTMAP_H
@@ -11,6 +11,75 @@
 
 #include "LinkedList.h"
 
+// The data lives after the node, at the first offset aligned for any type.
+#define LLIST_DATA_OFFSET ((sizeof(Node) + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN)
+
+// Find the node at an index, walking from whichever end of the list is closer.
+// The index must be in bounds.
+static Node* llist_node_at(LinkedList* llist, int index)
+{
+    Node *temp;
+
+    if(index < llist->size / 2)
+    {
+        temp = llist->first;
+        for(int i=0; i < index; i++)
+            temp = temp->next;
+    }
+    else
+    {
+        temp = llist->last;
+        for(int i=llist->size-1; i > index; i--)
+            temp = temp->prev;
+    }
+
+    return temp;
+}
+
+// Unlink the node at an index from the list. The node is not released.
+static Node* llist_unlink(LinkedList* llist, int index)
+{
+    // Find the node to be removed.
+    Node *temp = llist_node_at(llist, index);
+
+    // Adjust the pointers of adjacent nodes and linked list:
+    // 1) If the list only has one node, we simply set the
+    //    linked list's first and last pointers to NULL.
+    // 2) If we are removing the first node, we only have to
+    //    adjust the next node's pointers and update the
+    //    linked list's first node pointer.
+    // 3) If we are removing the last node, we only have to
+    //    adjust the previous node's pointers and update the
+    //    linked list's last node pointer.
+    // 4) Otherwise we adjust the next and prev nodes to make
+    //    sure they point to each other.
+    if(llist->size == 1)
+    {
+        llist->first = NULL;
+        llist->last  = NULL;
+    }
+    else if(index == 0)
+    {
+        llist->first = temp->next;
+        llist->first->prev = NULL;
+    }
+    else if(index == llist->size-1)
+    {
+        llist->last = temp->prev;
+        llist->last->next = NULL;
+    }
+    else
+    {
+        temp->prev->next = temp->next;
+        temp->next->prev = temp->prev;
+    }
+
+    // Reduce the size of the linked list by 1.
+    llist->size--;
+
+    return temp;
+}
+
 LinkedList* llist_initialize(int typeSize, char* typeName)
 {
     // Create a linked list struct.
@@ -39,6 +108,9 @@ LinkedList* llist_initialize(int typeSize, char* typeName)
     llist->size  = 0;
     llist->itemSize = typeSize;
 
+    // Nodes and their payloads are carved out of the list's own slabs.
+    pool_init(&llist->pool, LLIST_DATA_OFFSET + typeSize);
+
     // Return the empty linked list.
     return llist;
 }
@@ -54,21 +126,15 @@ bool llist_add_at(LinkedList* llist, int index, void* element)
     if(index < 0 || index > llist->size)
         return false;
 
-    // Allocate space for a new node.
-    Node *node = malloc(sizeof(*node));
+    // Take a node with room for the data from the pool.
+    Node *node = pool_alloc(&llist->pool);
 
     // If we can't allocate memory, return false.
     if(node == NULL)
         return false;
 
-    // Allocate space for the node's data.
-    node->data = malloc(llist->itemSize);
-
-    if(node->data == NULL)
-    {
-        free(node);
-        return false;
-    }
+    // The data lives after the node.
+    node->data = (char*)node + LLIST_DATA_OFFSET;
 
     // Copy the element data into the node.
     memcpy(node->data, element, llist->itemSize);
@@ -104,12 +170,8 @@ bool llist_add_at(LinkedList* llist, int index, void* element)
         // in the middle of the list.
     else
     {
-        // Create a temporary traversal node.
-        Node *temp = llist->first;
-
-        // Iterate until we get to the node to be removed.
-        for(int i=0; i < index; i++)
-            temp = temp->next;
+        // Find the node currently at the index.
+        Node *temp = llist_node_at(llist, index);
 
         // Set the new node's previous to the current node's previous.
         node->prev = temp->prev;
@@ -158,12 +220,8 @@ void* llist_get(LinkedList* llist, int index)
     if(index < 0 || index >= llist->size)
         return NULL;
 
-    // Create a temporary node variable and store the first node.
-    Node *temp = llist->first;
-
-    // Iterate through the list until we find the element.
-    for(int i=0; i < index; i++)
-        temp = temp->next;
+    // Find the node holding the element.
+    Node *temp = llist_node_at(llist, index);
 
     // Allocate enough space for a copy of the data.
     void* data = malloc(llist->itemSize);
@@ -179,6 +237,52 @@ void* llist_get(LinkedList* llist, int index)
     return data;
 }
 
+void* llist_peek_at(LinkedList* llist, int index)
+{
+    // If the list is null or the index isn't in the list, return null.
+    if(llist == NULL || index < 0 || index >= llist->size)
+        return NULL;
+
+    // Return the stored element itself, no copy is made.
+    return llist_node_at(llist, index)->data;
+}
+
+void* llist_peek_first(LinkedList* llist)
+{
+    // We can simply call/return "peek_at". It will check for NULL.
+    return llist_peek_at(llist, 0);
+}
+
+void* llist_peek_last(LinkedList* llist)
+{
+    // We need to check if llist is null before we
+    // use llist->size, otherwise we'll seg fault.
+    if(llist == NULL)
+        return NULL;
+
+    return llist_peek_at(llist, llist->size-1);
+}
+
+LListIterator llist_iterator(LinkedList* llist)
+{
+    // The iterator starts at the first node, an empty or null list has none.
+    LListIterator iter;
+    iter.next = llist == NULL ? NULL : llist->first;
+    return iter;
+}
+
+void* llist_iterator_next(LListIterator* iter)
+{
+    // Return null once we have run off the end of the list.
+    if(iter == NULL || iter->next == NULL)
+        return NULL;
+
+    // Hand out the stored element and step to the following node.
+    void* data = iter->next->data;
+    iter->next = iter->next->next;
+    return data;
+}
+
 int llist_index_of(LinkedList* llist, void* element)
 {
     // If the list is null or the element is null, we return -1.
@@ -214,59 +318,42 @@ void* llist_remove(LinkedList* llist, int index)
     if(index < 0 || index >= llist->size)
         return NULL;
 
-    // Create a temporary node.
-    Node *temp = llist->first;
-
-    // Iterate until we get to the node to be removed.
-    for(int i=0; i < index; i++)
-        temp = temp->next;
-
-    // Adjust the pointers of adjacent nodes and linked list:
-    // 1) If the list only has one node, we simply set the
-    //    linked list's first and last pointers to NULL.
-    // 2) If we are removing the first node, we only have to
-    //    adjust the next node's pointers and update the
-    //    linked list's first node pointer.
-    // 3) If we are removing the last node, we only have to
-    //    adjust the previous node's pointers and update the
-    //    linked list's last node pointer.
-    // 4) Otherwise we adjust the next and prev nodes to make
-    //    sure they point to each other.
-    if(llist->size == 1)
-    {
-        llist->first = NULL;
-        llist->last  = NULL;
-    }
-    else if(index == 0)
-    {
-        llist->first = temp->next;
-        llist->first->prev = NULL;
-    }
-    else if(index == llist->size-1)
-    {
-        llist->last = temp->prev;
-        llist->last->next = NULL;
-    }
-    else
-    {
-        temp->prev->next = temp->next;
-        temp->next->prev = temp->prev;
-    }
-
-    // Reduce the size of the linked list by 1.
-    llist->size--;
+    // The node's payload goes back to the pool, so the caller gets a copy.
+    void* data = malloc(llist->itemSize);
 
-    // Save the data from the node.
-    void* data = temp->data;
+    // If we can't allocate space, return null.
+    if(data == NULL)
+        return NULL;
 
-    // Free the node.
-    free(temp);
+    llist_remove_into(llist, index, data);
 
     // Return the removed data. This should be the only
     // pointer to it. It is up to the owner to free it.
     return data;
 }
 
+bool llist_remove_into(LinkedList* llist, int index, void* element)
+{
+    // If the list or element is null, return false.
+    if(llist == NULL || element == NULL)
+        return false;
+
+    // If the index is out of bounds, return false.
+    if(index < 0 || index >= llist->size)
+        return false;
+
+    // Take the node out of the list.
+    Node *temp = llist_unlink(llist, index);
+
+    // Copy the data out for the caller.
+    memcpy(element, temp->data, llist->itemSize);
+
+    // Give the node back to the pool.
+    pool_free(&llist->pool, temp);
+
+    return true;
+}
+
 void* llist_remove_first(LinkedList* llist)
 {
     // We can call "remove" on the first index.
@@ -290,29 +377,8 @@ bool llist_destroy(LinkedList* llist)
     if(llist == NULL)
         return false;
 
-    // If there are nodes available in the list, free them.
-    if(llist->size > 0)
-    {
-        // Create a temporary node for holding nodes.
-        Node *current = llist->first;
-        Node *next    = NULL;
-
-        // Iterate through all of the nodes.
-        for(int i=0; i < llist->size; i++)
-        {
-            // Store a pointer to the next node.
-            next = current->next;
-
-            // Free this node's data.
-            free(current->data);
-
-            // Free this node.
-            free(current);
-
-            // We move to the next node.
-            current = next;
-        }
-    }
+    // All nodes and their data live in the pool's slabs, free them.
+    pool_destroy(&llist->pool);
 
     // Free the necessary linked list fields.
     free(llist->type);
@@ -15,7 +15,11 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include "NodePool.h"
 
+// A node and its payload are a single block from the list's pool, data points
+// just past the node. Pointers from the peek and iterator functions borrow
+// that payload and are valid until the element is removed.
 typedef struct _Node{
     void* data;
     struct _Node* next;
@@ -28,15 +32,26 @@ typedef struct _LinkedList{
     int size;
     int itemSize;
     char* type;
+    NodePool pool;
 }LinkedList;
 
+typedef struct _LListIterator{
+    Node* next;
+}LListIterator;
+
 LinkedList* llist_initialize(int, char*);
 bool llist_add_at(LinkedList*, int, void*);
 bool llist_add_first(LinkedList*, void*);
 bool llist_add_last(LinkedList*, void*);
 void* llist_get(LinkedList*, int);
+void* llist_peek_at(LinkedList*, int);
+void* llist_peek_first(LinkedList*);
+void* llist_peek_last(LinkedList*);
+LListIterator llist_iterator(LinkedList*);
+void* llist_iterator_next(LListIterator*);
 int llist_index_of(LinkedList*, void*);
 void* llist_remove(LinkedList*, int);
+bool llist_remove_into(LinkedList*, int, void*);
 void* llist_remove_first(LinkedList*);
 void* llist_remove_last(LinkedList*);
 bool llist_destroy(LinkedList*);
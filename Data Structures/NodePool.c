@@ -0,0 +1,62 @@
+/*H**********************************************************************
+* FILENAME :        NodePool.c
+*
+* DESCRIPTION :
+*       Implementation of a fixed-size node pool
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+#include "NodePool.h"
+
+// Set up an empty pool for nodes of the given size
+void pool_init(NodePool* pool, int nodeSize){
+    if(nodeSize < (int)sizeof(PoolFree)) nodeSize = sizeof(PoolFree);
+    pool->nodeSize = (nodeSize + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    pool->slabs = NULL;
+    pool->freeList = NULL;
+}
+
+// get a zeroed node, a new slab is only allocated when every node is in use
+void* pool_alloc(NodePool* pool){
+    if(pool->freeList == NULL){
+        // the slab header is padded to the node alignment so the nodes after it stay aligned
+        size_t header = (sizeof(PoolSlab) + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+        PoolSlab* slab = malloc(header + (size_t)pool->nodeSize * POOL_SLAB_NODES);
+        if(slab == NULL) return NULL;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+
+        // thread the new nodes onto the free list
+        char* nodes = (char*)slab + header;
+        for(int i = POOL_SLAB_NODES - 1; i >= 0; i--){
+            PoolFree* node = (PoolFree*)(nodes + (size_t)i * pool->nodeSize);
+            node->next = pool->freeList;
+            pool->freeList = node;
+        }
+    }
+
+    PoolFree* node = pool->freeList;
+    pool->freeList = node->next;
+    memset(node, 0, pool->nodeSize);
+
+    return node;
+}
+
+// give a node back to the pool
+void pool_free(NodePool* pool, void* node){
+    if(node == NULL) return;
+
+    PoolFree* freeNode = node;
+    freeNode->next = pool->freeList;
+    pool->freeList = freeNode;
+}
+
+// release every slab, nodes still in use become invalid
+void pool_destroy(NodePool* pool){
+    while(pool->slabs != NULL){
+        PoolSlab* next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    pool->freeList = NULL;
+}
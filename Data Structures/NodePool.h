@@ -0,0 +1,45 @@
+/*H**********************************************************************
+* FILENAME :        NodePool.h
+*
+* DESCRIPTION :
+*       Implementation of a fixed-size node pool
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+
+#ifndef TEST_NODEPOOL_H
+#define TEST_NODEPOOL_H
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Nodes are carved out of slabs holding this many nodes each.
+#define POOL_SLAB_NODES 64
+
+// Node sizes are rounded up so every node in a slab is aligned for any type.
+#define POOL_ALIGN _Alignof(max_align_t)
+
+// A slab of nodes, slabs are chained so they can be freed together.
+typedef struct _PoolSlab{
+    struct _PoolSlab* next;
+}PoolSlab;
+
+// A free node, the link overlays the start of the node while it is unused.
+typedef struct _PoolFree{
+    struct _PoolFree* next;
+}PoolFree;
+
+// Recycles nodes of one size. A pool is not thread safe, each queue owns its own.
+typedef struct _NodePool{
+    PoolSlab* slabs;
+    PoolFree* freeList;
+    int nodeSize;
+}NodePool;
+
+void pool_init(NodePool* pool, int nodeSize);
+void* pool_alloc(NodePool* pool);
+void pool_free(NodePool* pool, void* node);
+void pool_destroy(NodePool* pool);
+
+#endif //TEST_NODEPOOL_H
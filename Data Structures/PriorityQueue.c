@@ -8,85 +8,350 @@
 *H*/
 #include "PriorityQueue.h"
 
+#define PQ_INITIAL_CAPACITY 16
+#define PQ_WORD_BITS 64
+
+// Ordering used by the heap: lower priority value first, and among equal
+// priorities the node that was enqueued first.
+static bool pq_before(PriorityNode* a, PriorityNode* b){
+    if(a->priority != b->priority) return a->priority < b->priority;
+    return a->seq < b->seq;
+}
+
+// place a node at a heap position and keep its handle index in sync
+static void pq_place(PriorityQueue* pq, int index, PriorityNode* node){
+    pq->heap[index] = node;
+    node->index = index;
+}
+
+// move the node at index towards the root until its parent comes before it
+static void pq_sift_up(PriorityQueue* pq, int index){
+    PriorityNode* node = pq->heap[index];
+
+    while(index > 0){
+        int parent = (index - 1) / PQ_ARITY;
+        if(!pq_before(node, pq->heap[parent])) break;
+        pq_place(pq, index, pq->heap[parent]);
+        index = parent;
+    }
+    pq_place(pq, index, node);
+}
+
+// move the node at index towards the leaves until it comes before all of its children
+static void pq_sift_down(PriorityQueue* pq, int index){
+    PriorityNode* node = pq->heap[index];
+
+    for(;;){
+        int first = index * PQ_ARITY + 1;
+        if(first >= pq->size) break;
+
+        // find the child that should come first
+        int last = first + PQ_ARITY < pq->size ? first + PQ_ARITY : pq->size;
+        int best = first;
+        for(int i = first + 1; i < last; i++){
+            if(pq_before(pq->heap[i], pq->heap[best])) best = i;
+        }
+
+        if(!pq_before(pq->heap[best], node)) break;
+        pq_place(pq, index, pq->heap[best]);
+        index = best;
+    }
+    pq_place(pq, index, node);
+}
+
+// add a node to its bucket, keeping the bucket in FIFO order
+static void pq_bucket_insert(PriorityQueue* pq, PriorityNode* node){
+    PriorityBucket* bucket = &pq->buckets[node->priority];
+
+    // a node normally joins at the tail, only pq_update can move an older node in
+    PriorityNode* prev = bucket->tail;
+    while(prev != NULL && node->seq < prev->seq){
+        prev = prev->prev;
+    }
+
+    node->index = PQ_IN_BUCKET;
+    node->prev = prev;
+    if(prev == NULL){
+        node->next = bucket->head;
+        bucket->head = node;
+    } else{
+        node->next = prev->next;
+        prev->next = node;
+    }
+
+    if(node->next == NULL){
+        bucket->tail = node;
+    } else{
+        node->next->prev = node;
+    }
+
+    pq->bitmap[node->priority / PQ_WORD_BITS] |= (uint64_t)1 << (node->priority % PQ_WORD_BITS);
+}
+
+// take a node out of its bucket
+static void pq_bucket_unlink(PriorityQueue* pq, PriorityNode* node){
+    PriorityBucket* bucket = &pq->buckets[node->priority];
+
+    if(node->prev == NULL){
+        bucket->head = node->next;
+    } else{
+        node->prev->next = node->next;
+    }
+
+    if(node->next == NULL){
+        bucket->tail = node->prev;
+    } else{
+        node->next->prev = node->prev;
+    }
+
+    if(bucket->head == NULL){
+        pq->bitmap[node->priority / PQ_WORD_BITS] &= ~((uint64_t)1 << (node->priority % PQ_WORD_BITS));
+    }
+
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+// return the head of the first non-empty bucket, NULL if all are empty
+static PriorityNode* pq_bucket_first(PriorityQueue* pq){
+    int words = (pq->numBuckets + PQ_WORD_BITS - 1) / PQ_WORD_BITS;
+
+    for(int i = 0; i < words; i++){
+        if(pq->bitmap[i] != 0){
+            return pq->buckets[i * PQ_WORD_BITS + __builtin_ctzll(pq->bitmap[i])].head;
+        }
+    }
+    return NULL;
+}
+
+// grow the heap array if it is full
+static bool pq_reserve(PriorityQueue* pq, int capacity){
+    if(capacity <= pq->capacity) return true;
+
+    int newCapacity = pq->capacity;
+    while(newCapacity < capacity) newCapacity *= 2;
+
+    PriorityNode** heap = realloc(pq->heap, newCapacity * sizeof(PriorityNode*));
+    if(heap == NULL) return false;
+    pq->heap = heap;
+    pq->capacity = newCapacity;
+    return true;
+}
+
+// Switch a bounded queue over to the heap. Emptying the buckets in priority
+// order, each in FIFO order, produces a sorted array, which is already a heap.
+static bool pq_unbound(PriorityQueue* pq){
+    if(!pq_reserve(pq, pq->size + 1)) return false;
+
+    int index = 0;
+    for(int p = 0; p < pq->numBuckets; p++){
+        for(PriorityNode* node = pq->buckets[p].head; node != NULL; node = node->next){
+            pq_place(pq, index++, node);
+        }
+    }
+    for(int i = 0; i < index; i++){
+        pq->heap[i]->next = NULL;
+        pq->heap[i]->prev = NULL;
+    }
+
+    free(pq->buckets);
+    free(pq->bitmap);
+    pq->buckets = NULL;
+    pq->bitmap = NULL;
+    pq->numBuckets = 0;
+    return true;
+}
 
 // Create a PriorityQueue
 PriorityQueue* pq_init(int typeSize){
     PriorityQueue* pq = calloc(1, sizeof(PriorityQueue));
     pq->size = 0;
     pq->typeSize = typeSize;
+    pq->capacity = PQ_INITIAL_CAPACITY;
+    pq->heap = calloc(pq->capacity, sizeof(PriorityNode*));
+    pool_init(&pq->pool, sizeof(PriorityNode));
+
+    return pq;
+}
+
+// Create a PriorityQueue that uses O(1) buckets while every priority is in 0..numBuckets-1
+PriorityQueue* pq_init_bounded(int typeSize, int numBuckets){
+    PriorityQueue* pq = pq_init(typeSize);
+    if(pq == NULL || numBuckets <= 0) return pq;
+
+    pq->buckets = calloc(numBuckets, sizeof(PriorityBucket));
+    pq->bitmap = calloc((numBuckets + PQ_WORD_BITS - 1) / PQ_WORD_BITS, sizeof(uint64_t));
+    pq->numBuckets = numBuckets;
 
     return pq;
 }
 
-// Add some data to the PriorityQueue based on its priority
-bool pq_enqueue(PriorityQueue* pq, void* data, int priority){
-    if(data == NULL) return false;
+// Add some data to the PriorityQueue based on its priority, returns the node
+// as a handle for pq_removeAt/pq_update (NULL on failure)
+PriorityNode* pq_enqueue(PriorityQueue* pq, void* data, int priority){
+    if(pq == NULL || data == NULL) return NULL;
+
+    // a priority the buckets cannot hold turns the queue into a heap for good
+    if(pq->numBuckets > 0 && (priority < 0 || priority >= pq->numBuckets)){
+        if(!pq_unbound(pq)) return NULL;
+    }
+
+    if(pq->numBuckets == 0 && !pq_reserve(pq, pq->size + 1)) return NULL;
 
-    // create new PriorityNode and initialize it
-    PriorityNode* newNode = calloc(1, sizeof(PriorityNode));
-    newNode->data = calloc(1, pq->typeSize);
-//    memcpy(newNode->data, data, pq->typeSize);
+    // take a recycled PriorityNode and initialize it
+    PriorityNode* newNode = pool_alloc(&pq->pool);
+    if(newNode == NULL) return NULL;
     newNode->data = data;
     newNode->priority = priority;
+    newNode->seq = pq->nextSeq++;
 
-    // if head is null, this node becomes the head
-    if(pq->head == NULL){
-        pq->head = newNode;
-        pq->tail = newNode;
-    } else{
-        // otherwise, find where the new node needs to be inserted
-        PriorityNode* temp = pq->head;
-        PriorityNode* prev = NULL;
+    if(pq->numBuckets > 0){
+        pq_bucket_insert(pq, newNode);
+        pq->size++;
+        return newNode;
+    }
+
+    // add it as the last leaf and restore the heap order
+    pq_place(pq, pq->size, newNode);
+    pq->size++;
+    pq_sift_up(pq, pq->size - 1);
+
+    return newNode;
+}
+
+// Add count items at once, as if each had been enqueued in array order. Handles
+// are stored in handles if it is not NULL. When the batch is at least as large
+// as the queue the heap is rebuilt bottom-up in O(n) instead of sifting each item.
+// A NULL item rejects the whole batch untouched; if a node cannot be allocated, the
+// items before it stay queued, in order, and false is returned.
+bool pq_enqueue_batch(PriorityQueue* pq, void** data, int* priorities, int count, PriorityNode** handles){
+    if(pq == NULL || data == NULL || priorities == NULL) return false;
 
-        while(temp != NULL && newNode->priority >= temp->priority){
-            prev = temp;
-            temp = temp->next;
+    // reject the whole batch before touching the queue if any item is missing
+    for(int i = 0; i < count; i++){
+        if(data[i] == NULL) return false;
+    }
+
+    // a priority the buckets cannot hold turns the queue into a heap for good
+    for(int i = 0; i < count && pq->numBuckets > 0; i++){
+        if(priorities[i] < 0 || priorities[i] >= pq->numBuckets){
+            if(!pq_unbound(pq)) return false;
+        }
+    }
+
+    if(pq->numBuckets == 0 && !pq_reserve(pq, pq->size + count)) return false;
+
+    int first = pq->size;
+    bool heapify = pq->numBuckets == 0 && count >= first;
+
+    bool added = true;
+    for(int i = 0; i < count; i++){
+        PriorityNode* newNode = pool_alloc(&pq->pool);
+        if(newNode == NULL){
+            added = false;
+            break;
         }
+        newNode->data = data[i];
+        newNode->priority = priorities[i];
+        newNode->seq = pq->nextSeq++;
+        if(handles != NULL) handles[i] = newNode;
 
-        // insert the new node accordingly (1. at the end, 2. at the start, 3. in the middle)
-        if(temp == NULL){
-            prev->next = newNode;
-            pq->tail = newNode;
-        } else if(temp == pq->head){
-            newNode->next = pq->head;
-            pq->head = newNode;
+        if(pq->numBuckets > 0){
+            pq_bucket_insert(pq, newNode);
+            pq->size++;
         } else{
-            newNode->next = temp;
-            prev->next = newNode;
+            pq_place(pq, pq->size, newNode);
+            pq->size++;
+            if(!heapify) pq_sift_up(pq, pq->size - 1);
         }
     }
 
-    // increment size
-    pq->size++;
-    return true;
+    // sift down every internal node, starting from the last one, even if an allocation
+    // failed part way so that the items that did go in leave the queue in heap order
+    if(heapify && pq->size > 1){
+        for(int i = (pq->size - 2) / PQ_ARITY; i >= 0; i--){
+            pq_sift_down(pq, i);
+        }
+    }
+
+    return added;
 }
 
-// remove node from the head of the PriorityQueue
+// remove node from the head of the PriorityQueue, returns its data
 void* pq_dequeue(PriorityQueue* pq){
-    if(pq == NULL || pq->head == NULL) return NULL;
-
-    // 2 cases: case 1 -> only 1 item in PriorityQueue ; case 2 -> more than 1 item
-    PriorityNode* temp;
-    if(pq->head == pq->tail){
-        temp = pq->head;
-        pq->head = NULL;
-        pq->tail = NULL;
-    } else{
-        temp = pq->head;
-        pq->head = pq->head->next;
-    }
+    if(pq == NULL || pq->size == 0) return NULL;
 
-    // decrement size
-    pq->size--;
-    return temp;
+    return pq_removeAt(pq, pq_peek(pq));
 }
 
 // return the front most item in the PriorityQueue
 void* pq_peek(PriorityQueue* pq){
-    if(pq == NULL || pq->head == NULL) return NULL;
+    if(pq == NULL || pq->size == 0) return NULL;
 
-    PriorityNode* temp = pq->head;
-    return temp;
+    if(pq->numBuckets > 0) return pq_bucket_first(pq);
+    return pq->heap[0];
+}
+
+// remove a queued node, wherever it is in the PriorityQueue, returns its data
+void* pq_removeAt(PriorityQueue* pq, PriorityNode* node){
+    if(pq == NULL || node == NULL) return NULL;
+
+    if(node->index == PQ_IN_BUCKET){
+        if(pq->numBuckets == 0) return NULL;
+        pq_bucket_unlink(pq, node);
+        pq->size--;
+    } else{
+        if(node->index < 0 || node->index >= pq->size || pq->heap[node->index] != node) return NULL;
+
+        int index = node->index;
+        pq->size--;
+
+        // fill the hole with the last leaf and move it whichever way it needs to go
+        if(index != pq->size){
+            pq_place(pq, index, pq->heap[pq->size]);
+            if(index > 0 && pq_before(pq->heap[index], pq->heap[(index - 1) / PQ_ARITY])){
+                pq_sift_up(pq, index);
+            } else{
+                pq_sift_down(pq, index);
+            }
+        }
+    }
+
+    // the handle is dead from here on, its node goes back to the pool
+    void* data = node->data;
+    node->index = -1;
+    pool_free(&pq->pool, node);
+    return data;
+}
+
+// change the priority of a queued node; the node keeps its FIFO position among equal priorities
+bool pq_update(PriorityQueue* pq, PriorityNode* node, int priority){
+    if(pq == NULL || node == NULL) return false;
+
+    if(node->index == PQ_IN_BUCKET){
+        if(pq->numBuckets == 0) return false;
+
+        // move between buckets if the new priority fits, otherwise fall through to the heap
+        if(priority >= 0 && priority < pq->numBuckets){
+            pq_bucket_unlink(pq, node);
+            node->priority = priority;
+            pq_bucket_insert(pq, node);
+            return true;
+        }
+        if(!pq_unbound(pq)) return false;
+    }
+
+    if(node->index < 0 || node->index >= pq->size || pq->heap[node->index] != node) return false;
+
+    int old = node->priority;
+    node->priority = priority;
+    if(priority < old){
+        pq_sift_up(pq, node->index);
+    } else{
+        pq_sift_down(pq, node->index);
+    }
+
+    return true;
 }
 
 // check if PriorityQueue is empty
@@ -94,29 +359,34 @@ bool pq_is_empty(PriorityQueue* pq){
     return pq->size <= 0;
 }
 
-// deallocate PriorityQueue
+// deallocate PriorityQueue, the queued data belongs to the caller and is not freed
 bool pq_destroy(PriorityQueue* pq){
     if(pq == NULL) return false;
 
-    PriorityNode* temp = pq->head;
-
-    while(temp != NULL){
-        free(temp->data);
-        temp = temp->next;
-    }
-
+    pool_destroy(&pq->pool);
+    free(pq->buckets);
+    free(pq->bitmap);
+    free(pq->heap);
     free(pq);
 
     return true;
 }
 
-// iterate over and print PriorityQueue
+// iterate over and print PriorityQueue (bucket by bucket, or in heap order, not priority order)
 void pq_print(PriorityQueue* pq){
     if(pq == NULL) return;
 
-    PriorityNode* temp = pq->head;
-    while(temp != NULL){
-        printf("%d->", *(int*)temp->data);
-        temp = temp->next;
+    // the heap array is only filled in once the queue is a heap
+    if(pq->numBuckets > 0){
+        for(int p = 0; p < pq->numBuckets; p++){
+            for(PriorityNode* node = pq->buckets[p].head; node != NULL; node = node->next){
+                printf("%d->", *(int*)node->data);
+            }
+        }
+        return;
     }
-}
\ No newline at end of file
+
+    for(int i = 0; i < pq->size; i++){
+        printf("%d->", *(int*)pq->heap[i]->data);
+    }
+}
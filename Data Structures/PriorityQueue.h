@@ -13,25 +13,59 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "NodePool.h"
 
+// Number of children per heap node. A 4-ary heap is shallower than a binary
+// heap and keeps a node's children on the same cache line.
+#define PQ_ARITY 4
+
+// index of a node that is queued in a bucket rather than in the heap
+#define PQ_IN_BUCKET (-2)
+
+// A queued item. The node doubles as a stable handle: it stays at the same
+// address for as long as the item is queued, so it can be passed back to
+// pq_removeAt and pq_update. Nodes belong to the queue and are recycled once
+// their item is removed.
 typedef struct _PriorityNode{
     void* data;
     int priority;
-    struct _PriorityNode* next;
+    unsigned long seq;      // insertion order, keeps equal priorities FIFO
+    int index;              // position in the heap array, -1 when not queued
+    struct _PriorityNode* next;     // bucket links
+    struct _PriorityNode* prev;
 }PriorityNode;
 
-typedef struct _PriorityQueue{
+// FIFO list of the nodes that share one priority
+typedef struct _PriorityBucket{
     PriorityNode* head;
     PriorityNode* tail;
+}PriorityBucket;
+
+// A queue created with pq_init_bounded keeps priorities 0..numBuckets-1 in FIFO
+// buckets and finds the first non-empty one with a bitmap, so enqueue and
+// dequeue are O(1). The first priority outside that range moves every node
+// into the heap and the queue stays a heap from then on.
+typedef struct _PriorityQueue{
+    PriorityNode** heap;
     int size;
+    int capacity;
     int typeSize;
+    unsigned long nextSeq;
+    NodePool pool;
+    PriorityBucket* buckets;
+    uint64_t* bitmap;       // bit p is set when bucket p is not empty
+    int numBuckets;         // 0 when the queue is a heap
 }PriorityQueue;
 
 PriorityQueue* pq_init(int typeSize);
-bool pq_enqueue(PriorityQueue* pq, void* data, int priority);
+PriorityQueue* pq_init_bounded(int typeSize, int numBuckets);
+PriorityNode* pq_enqueue(PriorityQueue* pq, void* data, int priority);
+bool pq_enqueue_batch(PriorityQueue* pq, void** data, int* priorities, int count, PriorityNode** handles);
 void* pq_dequeue(PriorityQueue* pq);
 void* pq_peek(PriorityQueue* pq);
-void* pq_removeAt(PriorityQueue* pq);
+void* pq_removeAt(PriorityQueue* pq, PriorityNode* node);
+bool pq_update(PriorityQueue* pq, PriorityNode* node, int priority);
 bool pq_destroy(PriorityQueue* pq);
 bool pq_is_empty(PriorityQueue* pq);
 
@@ -40,13 +40,14 @@ void* stack_pop(Stack* stack){
     return llist_remove_first(stack->linkedList);
 }
 
+// returns the top item itself rather than a copy, valid until it is popped
 void* stack_peek(Stack* stack){
     if(stack == NULL){
         printf("Stack is NULL (peek)\n");
         return NULL;
     }
 
-    return llist_get(stack->linkedList, 0);
+    return llist_peek_first(stack->linkedList);
 }
 
 int stack_size(Stack* stack){
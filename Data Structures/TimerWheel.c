@@ -0,0 +1,356 @@
+/*H**********************************************************************
+* FILENAME :        TimerWheel.c
+*
+* DESCRIPTION :
+*       Implementation of a hierarchical timing wheel
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+#include "TimerWheel.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+
+// Ordering used by every list in the wheel: earlier time first, and among
+// equal times the node that was inserted first.
+static bool tw_before(TimerNode* a, TimerNode* b){
+    if(a->time != b->time) return a->time < b->time;
+    return a->seq < b->seq;
+}
+
+// add a node at the tail of a wheel list, which is not kept in order, and
+// remember it if it is now the list's earliest node
+static void tw_list_append(TimerList* list, TimerNode* node){
+    node->list = list;
+    node->prev = list->tail;
+    node->next = NULL;
+    if(list->tail == NULL){
+        list->head = node;
+    } else{
+        list->tail->next = node;
+    }
+    list->tail = node;
+
+    if(list->first == NULL || tw_before(node, list->first)){
+        list->first = node;
+    }
+}
+
+// insert a node into the expired list, keeping the list ordered. New nodes
+// almost always belong at the tail, so the walk starts there.
+static void tw_list_insert(TimerList* list, TimerNode* node){
+    TimerNode* prev = list->tail;
+    while(prev != NULL && tw_before(node, prev)){
+        prev = prev->prev;
+    }
+
+    node->list = list;
+    node->prev = prev;
+    if(prev == NULL){
+        node->next = list->head;
+        list->head = node;
+    } else{
+        node->next = prev->next;
+        prev->next = node;
+    }
+
+    if(node->next == NULL){
+        list->tail = node;
+    } else{
+        node->next->prev = node;
+    }
+}
+
+// find the earliest node of a list that is not kept in order
+static TimerNode* tw_list_earliest(TimerList* list){
+    TimerNode* first = list->head;
+    for(TimerNode* node = list->head; node != NULL; node = node->next){
+        if(tw_before(node, first)) first = node;
+    }
+    return first;
+}
+
+// take a node out of whichever list it is on
+static void tw_list_unlink(TimerNode* node){
+    TimerList* list = node->list;
+
+    if(node->prev == NULL){
+        list->head = node->next;
+    } else{
+        node->prev->next = node->next;
+    }
+
+    if(node->next == NULL){
+        list->tail = node->prev;
+    } else{
+        node->next->prev = node->prev;
+    }
+
+    node->list = NULL;
+    node->next = NULL;
+    node->prev = NULL;
+
+    // only the removal of a pending node ahead of its time needs the walk
+    if(list->first == node){
+        list->first = tw_list_earliest(list);
+    }
+}
+
+// merge two chains linked through next that are each in order
+static TimerNode* tw_merge(TimerNode* a, TimerNode* b){
+    TimerNode head;
+    TimerNode* tail = &head;
+    while(a != NULL && b != NULL){
+        if(tw_before(b, a)){
+            tail->next = b;
+            b = b->next;
+        } else{
+            tail->next = a;
+            a = a->next;
+        }
+        tail = tail->next;
+    }
+    tail->next = a != NULL ? a : b;
+    return head.next;
+}
+
+// put a chain linked through next in order with a merge sort
+static TimerNode* tw_sort(TimerNode* chain){
+    if(chain == NULL || chain->next == NULL) return chain;
+
+    // split the chain in the middle
+    TimerNode* slow = chain;
+    TimerNode* fast = chain->next;
+    while(fast != NULL && fast->next != NULL){
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+    TimerNode* second = slow->next;
+    slow->next = NULL;
+
+    return tw_merge(tw_sort(chain), tw_sort(second));
+}
+
+// detach the nodes of a list, in order. Nodes usually arrive in order, so the
+// sort is only needed when a cascade brought in nodes that were queued earlier.
+static TimerNode* tw_list_take_sorted(TimerList* list){
+    TimerNode* chain = list->head;
+    list->head = NULL;
+    list->tail = NULL;
+    list->first = NULL;
+
+    for(TimerNode* node = chain; node != NULL && node->next != NULL; node = node->next){
+        if(tw_before(node->next, node)) return tw_sort(chain);
+    }
+    return chain;
+}
+
+// put a pending node (time >= now) into the level that covers its distance from now
+static void tw_place(TimerWheel* tw, TimerNode* node){
+    long delta = (long)node->time - tw->now;
+
+    for(int level = 0; level < TW_LEVELS; level++){
+        if(delta < (1L << (TW_SLOT_BITS * (level + 1)))){
+            int slot = (node->time >> (TW_SLOT_BITS * level)) & TW_MASK;
+            node->level = level;
+            tw->counts[level]++;
+            tw_list_append(&tw->slots[level][slot], node);
+            return;
+        }
+    }
+
+    node->level = TW_LEVELS;
+    tw->counts[TW_LEVELS]++;
+    tw_list_append(&tw->overflow, node);
+}
+
+// number of items still waiting in the wheel levels and the overflow list
+static int tw_pending(TimerWheel* tw){
+    int pending = 0;
+    for(int level = 0; level <= TW_LEVELS; level++){
+        pending += tw->counts[level];
+    }
+    return pending;
+}
+
+// move a node onto the expired list
+static void tw_expire(TimerWheel* tw, TimerNode* node){
+    node->level = -1;
+    tw_list_insert(&tw->expired, node);
+}
+
+// detach a list and place all of its nodes again relative to the current time
+static void tw_cascade(TimerWheel* tw, TimerList* list, int level){
+    TimerNode* node = list->head;
+    list->head = NULL;
+    list->tail = NULL;
+    list->first = NULL;
+
+    while(node != NULL){
+        TimerNode* next = node->next;
+        tw->counts[level]--;
+        tw_place(tw, node);
+        node = next;
+    }
+}
+
+// Process a single tick (tw->now has just been advanced to it). When the lowest
+// level wraps around, the next slot of the level above is redistributed, and so
+// on up the levels; the overflow list is reconsidered when the top level wraps.
+static void tw_tick(TimerWheel* tw){
+    if((tw->now & TW_MASK) == 0){
+        int level;
+        for(level = 1; level < TW_LEVELS; level++){
+            int slot = (tw->now >> (TW_SLOT_BITS * level)) & TW_MASK;
+            tw_cascade(tw, &tw->slots[level][slot], level);
+            if(slot != 0) break;
+        }
+        if(level == TW_LEVELS){
+            tw_cascade(tw, &tw->overflow, TW_LEVELS);
+        }
+    }
+
+    // everything in the current lowest level slot is due now. The slot holds a
+    // single time, so it only has to be put in insertion order
+    TimerNode* node = tw_list_take_sorted(&tw->slots[0][tw->now & TW_MASK]);
+    while(node != NULL){
+        TimerNode* next = node->next;
+        tw->counts[0]--;
+        tw_expire(tw, node);
+        node = next;
+    }
+}
+
+// Create a TimerWheel, anything inserted with a time at or before now is due immediately
+TimerWheel* tw_init(int now){
+    TimerWheel* tw = calloc(1, sizeof(TimerWheel));
+    tw->now = now;
+    pool_init(&tw->pool, sizeof(TimerNode));
+
+    return tw;
+}
+
+// Add some data to the TimerWheel to expire at the given time, returns the node
+// as a handle for tw_remove (NULL on failure)
+TimerNode* tw_insert(TimerWheel* tw, void* data, int time){
+    if(tw == NULL || data == NULL) return NULL;
+
+    TimerNode* node = pool_alloc(&tw->pool);
+    if(node == NULL) return NULL;
+    node->data = data;
+    node->time = time;
+    node->seq = tw->nextSeq++;
+
+    if(time <= tw->now){
+        tw_expire(tw, node);
+    } else{
+        tw_place(tw, node);
+    }
+
+    tw->size++;
+    return node;
+}
+
+// remove a node from the TimerWheel, whether it is pending or already expired
+void* tw_remove(TimerWheel* tw, TimerNode* node){
+    if(tw == NULL || node == NULL || node->list == NULL) return NULL;
+
+    if(node->level >= 0){
+        tw->counts[node->level]--;
+    }
+    tw_list_unlink(node);
+    tw->size--;
+
+    void* data = node->data;
+    pool_free(&tw->pool, node);
+    return data;
+}
+
+// Expire everything due at or before now. Expired items are handed out by
+// tw_pop_expired. Returns the number of expired items waiting to be popped.
+int tw_advance(TimerWheel* tw, int now){
+    if(tw == NULL) return 0;
+
+    while(tw->now < now){
+        // nothing left in the wheel, so there is nothing to cascade either
+        if(tw_pending(tw) == 0){
+            tw->now = now;
+            break;
+        }
+
+        // with the lowest level empty nothing can be due before it next wraps
+        if(tw->counts[0] == 0){
+            int boundary = tw->now | TW_MASK;
+            if(boundary >= now){
+                tw->now = now;
+                break;
+            }
+            tw->now = boundary;
+        }
+
+        tw->now++;
+        tw_tick(tw);
+    }
+
+    return tw->size - tw_pending(tw);
+}
+
+// remove the next expired item (earliest time first, FIFO among equal times), NULL if none
+void* tw_pop_expired(TimerWheel* tw){
+    if(tw == NULL || tw->expired.head == NULL) return NULL;
+
+    return tw_remove(tw, tw->expired.head);
+}
+
+// return the earliest time of any item in the TimerWheel, -1 if it is empty
+int tw_next_time(TimerWheel* tw){
+    if(tw == NULL || tw->size == 0) return -1;
+    if(tw->expired.head != NULL) return tw->expired.head->time;
+
+    int best = INT_MAX;
+
+    // the lowest level holds one time per slot, all within the next TW_SLOTS ticks
+    if(tw->counts[0] > 0){
+        for(int i = 1; i <= TW_SLOTS; i++){
+            if(tw->slots[0][(tw->now + i) & TW_MASK].head != NULL){
+                best = tw->now + i;
+                break;
+            }
+        }
+    }
+
+    // in the upper levels the first non-empty slot after the current one holds the
+    // earliest items of that level, and its list knows its earliest node
+    for(int level = 1; level < TW_LEVELS; level++){
+        if(tw->counts[level] == 0) continue;
+
+        int current = (tw->now >> (TW_SLOT_BITS * level)) & TW_MASK;
+        for(int i = 1; i <= TW_SLOTS; i++){
+            TimerNode* first = tw->slots[level][(current + i) & TW_MASK].first;
+            if(first != NULL){
+                if(first->time < best) best = first->time;
+                break;
+            }
+        }
+    }
+
+    if(tw->overflow.first != NULL && tw->overflow.first->time < best){
+        best = tw->overflow.first->time;
+    }
+
+    return best;
+}
+
+// check if TimerWheel is empty, expired items that have not been popped count as present
+bool tw_is_empty(TimerWheel* tw){
+    return tw->size <= 0;
+}
+
+// deallocate TimerWheel, the queued data belongs to the caller and is not freed
+bool tw_destroy(TimerWheel* tw){
+    if(tw == NULL) return false;
+
+    pool_destroy(&tw->pool);
+    free(tw);
+
+    return true;
+}
@@ -0,0 +1,67 @@
+/*H**********************************************************************
+* FILENAME :        TimerWheel.h
+*
+* DESCRIPTION :
+*       Implementation of a hierarchical timing wheel
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+
+#ifndef TEST_TIMERWHEEL_H
+#define TEST_TIMERWHEEL_H
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "NodePool.h"
+
+// Each level has 2^TW_SLOT_BITS slots and covers TW_SLOT_BITS more bits of
+// time than the level below it. Items further out than the top level can
+// reach wait in an overflow list.
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_LEVELS 4
+
+struct _TimerList;
+
+// A pending item. Like PriorityNode it is a stable handle that can be passed
+// to tw_remove for as long as the item is queued.
+typedef struct _TimerNode{
+    void* data;
+    int time;
+    unsigned long seq;          // insertion order, keeps equal times FIFO
+    int level;                  // wheel level, TW_LEVELS for overflow, -1 for expired
+    struct _TimerList* list;
+    struct _TimerNode* next;
+    struct _TimerNode* prev;
+}TimerNode;
+
+// The wheel's lists are appended to in O(1) and only put in order when their
+// slot comes due. The expired list is kept in order.
+typedef struct _TimerList{
+    TimerNode* head;
+    TimerNode* tail;
+    TimerNode* first;           // earliest node of a wheel list, NULL for the expired list
+}TimerList;
+
+typedef struct _TimerWheel{
+    TimerList slots[TW_LEVELS][TW_SLOTS];
+    int counts[TW_LEVELS + 1];  // items per level, last entry counts the overflow list
+    TimerList overflow;
+    TimerList expired;          // due items, ordered by time and then FIFO
+    int now;                    // every item due at or before now has been expired
+    int size;                   // all items, including expired ones not yet popped
+    unsigned long nextSeq;
+    NodePool pool;
+}TimerWheel;
+
+TimerWheel* tw_init(int now);
+TimerNode* tw_insert(TimerWheel* tw, void* data, int time);
+void* tw_remove(TimerWheel* tw, TimerNode* node);
+int tw_advance(TimerWheel* tw, int now);
+void* tw_pop_expired(TimerWheel* tw);
+int tw_next_time(TimerWheel* tw);
+bool tw_is_empty(TimerWheel* tw);
+bool tw_destroy(TimerWheel* tw);
+
+#endif //TEST_TIMERWHEEL_H
@@ -0,0 +1,101 @@
+/*H**********************************************************************
+* FILENAME :        WorkDeque.c
+*
+* DESCRIPTION :
+*       Implementation of a Chase-Lev work-stealing deque
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+#include "WorkDeque.h"
+
+// Create an empty deque that can hold at least capacity items
+WorkDeque* wd_init(int capacity){
+    WorkDeque* wd = aligned_alloc(WD_CACHE_LINE, sizeof(WorkDeque));
+    if(wd == NULL) return NULL;
+
+    // the item array is indexed with a mask, so its size is a power of two
+    long size = 1;
+    while(size < capacity) size *= 2;
+
+    wd->items = malloc(size * sizeof(*wd->items));
+    if(wd->items == NULL){
+        free(wd);
+        return NULL;
+    }
+    for(long i = 0; i < size; i++) atomic_init(&wd->items[i], NULL);
+
+    wd->mask = size - 1;
+    atomic_init(&wd->top, 0);
+    atomic_init(&wd->bottom, 0);
+    return wd;
+}
+
+// add an item at the bottom, only the owner may push. Returns false if the deque is full
+bool wd_push(WorkDeque* wd, void* item){
+    long b = atomic_load_explicit(&wd->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&wd->top, memory_order_acquire);
+    if(b - t > wd->mask) return false;
+
+    atomic_store_explicit(&wd->items[b & wd->mask], item, memory_order_relaxed);
+
+    // the item must be visible before a thief can see the new bottom
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&wd->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+// take the most recently pushed item, only the owner may pop. Returns NULL if empty
+void* wd_pop(WorkDeque* wd){
+    long b = atomic_load_explicit(&wd->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&wd->bottom, b, memory_order_relaxed);
+
+    // claiming the bottom slot has to be ordered before reading top, or a thief could take it too
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&wd->top, memory_order_relaxed);
+
+    if(t > b){
+        // the deque was empty, put bottom back
+        atomic_store_explicit(&wd->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void* item = atomic_load_explicit(&wd->items[b & wd->mask], memory_order_relaxed);
+    if(t == b){
+        // last item, race the thieves for it through top
+        if(!atomic_compare_exchange_strong_explicit(&wd->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)){
+            item = NULL;
+        }
+        atomic_store_explicit(&wd->bottom, b + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+// take the oldest item, any thread may steal. Returns NULL if empty or if another thread got there first
+void* wd_steal(WorkDeque* wd){
+    long t = atomic_load_explicit(&wd->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&wd->bottom, memory_order_acquire);
+    if(t >= b) return NULL;
+
+    void* item = atomic_load_explicit(&wd->items[t & wd->mask], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&wd->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)){
+        return NULL;
+    }
+    return item;
+}
+
+// check for items, the answer may be stale by the time a thief acts on it
+bool wd_is_empty(WorkDeque* wd){
+    long t = atomic_load_explicit(&wd->top, memory_order_acquire);
+    long b = atomic_load_explicit(&wd->bottom, memory_order_acquire);
+    return t >= b;
+}
+
+bool wd_destroy(WorkDeque* wd){
+    if(wd == NULL) return false;
+    free(wd->items);
+    free(wd);
+    return true;
+}
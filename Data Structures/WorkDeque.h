@@ -0,0 +1,35 @@
+/*H**********************************************************************
+* FILENAME :        WorkDeque.h
+*
+* DESCRIPTION :
+*       Implementation of a Chase-Lev work-stealing deque
+*
+* AUTHOR :    Saher Anwar Ziauddin
+*H*/
+
+#ifndef TEST_WORKDEQUE_H
+#define TEST_WORKDEQUE_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define WD_CACHE_LINE 64
+
+// The owning thread pushes and pops at the bottom, any other thread may steal from
+// the top. The capacity is fixed when the deque is created, so the item array never
+// moves under a thief.
+typedef struct _WorkDeque{
+    _Alignas(WD_CACHE_LINE) _Atomic long top;
+    _Alignas(WD_CACHE_LINE) _Atomic long bottom;
+    _Alignas(WD_CACHE_LINE) _Atomic(void*)* items;
+    long mask;
+}WorkDeque;
+
+WorkDeque* wd_init(int capacity);
+bool wd_push(WorkDeque* wd, void* item);
+void* wd_pop(WorkDeque* wd);
+void* wd_steal(WorkDeque* wd);
+bool wd_is_empty(WorkDeque* wd);
+bool wd_destroy(WorkDeque* wd);
+
+#endif //TEST_WORKDEQUE_H
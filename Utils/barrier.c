@@ -2,53 +2,208 @@
 // Created by saher on 20/07/2023.
 //
 
+#include <stdlib.h>
+#include <unistd.h>
 #include "barrier.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#else
+#include <sched.h>
+#endif
+
+// The state word of a tree node counts arrivals in its low half and members in its high half
+#define BARRIER_MEMBER ((uint64_t)1 << 32)
+#define BARRIER_ARRIVED(state) ((int)((state) & 0xffffffffu))
+#define BARRIER_MEMBERS(state) ((int)((state) >> 32))
+
+// The leaf a thread arrives at, assigned the first time the thread uses a barrier
+static __thread barrier_t* slot_barrier;
+static __thread int slot_leaf;
+
+static void barrier_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Sleep until the sense flag no longer holds the given value
+static void barrier_park(_Atomic int* sense, int value) {
+#ifdef __linux__
+    syscall(SYS_futex, sense, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+}
+
+static void barrier_wake_all(_Atomic int* sense) {
+#ifdef __linux__
+    syscall(SYS_futex, sense, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
 void barrier_init(barrier_t* barrier, int n) {
-    pthread_mutex_init(&barrier->mutex, NULL);
-    pthread_cond_init(&barrier->cond1, NULL);
-    pthread_cond_init(&barrier->cond2, NULL);
-    barrier->max_threads = n;
-    barrier->cur_threads = 0;
-    barrier->phase = 0;
+    if (n < 1) {
+        n = 1;
+    }
+
+    // Count the nodes of the tree level by level, up to a single root
+    int num_nodes = 0;
+    for (int width = n; ; width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN) {
+        int nodes = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+        num_nodes += nodes;
+        if (nodes == 1) {
+            break;
+        }
+    }
+
+    // Assume the allocation will be successful
+    barrier->nodes = aligned_alloc(BARRIER_CACHE_LINE, num_nodes * sizeof(barrier_node_t));
+    barrier->num_nodes = num_nodes;
+
+    // Level by level, node i of a level has members i*FANIN.. of the level below
+    int first = 0;
+    for (int width = n; ; ) {
+        int nodes = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+        for (int i = 0; i < nodes; i++) {
+            barrier_node_t* node = &barrier->nodes[first + i];
+            int members = width - i * BARRIER_FANIN;
+            if (members > BARRIER_FANIN) {
+                members = BARRIER_FANIN;
+            }
+            atomic_init(&node->state, members * BARRIER_MEMBER);
+            atomic_init(&node->min_value, INT_MAX);
+            node->parent = nodes == 1 ? -1 : first + nodes + i / BARRIER_FANIN;
+        }
+        if (nodes == 1) {
+            break;
+        }
+        first += nodes;
+        width = nodes;
+    }
+
+    atomic_init(&barrier->sense, 0);
+    atomic_init(&barrier->sleepers, 0);
+    atomic_init(&barrier->next_slot, 0);
+    barrier->result[0] = barrier->result[1] = INT_MAX;
+
+    // Spinning only pays off when the thread we wait for can run at the same time
+    barrier->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? BARRIER_SPIN : 0;
+    barrier->single = n == 1;
 }
 
-void barrier_wait(barrier_t* barrier) {
-    pthread_mutex_lock(&barrier->mutex);
-
-    barrier->cur_threads++;
-    if (barrier->cur_threads == barrier->max_threads) {
-        barrier->cur_threads = 0;
-        barrier->phase = 1 - barrier->phase;  // Alternating between 0 and 1
-
-        // Broadcasting on the current phase's condition variable
-        if (barrier->phase == 0) {
-            pthread_cond_broadcast(&barrier->cond2);
-        } else {
-            pthread_cond_broadcast(&barrier->cond1);
+// Find the leaf the calling thread arrives at
+static int barrier_leaf(barrier_t* barrier) {
+    if (slot_barrier != barrier) {
+        slot_barrier = barrier;
+        slot_leaf = atomic_fetch_add(&barrier->next_slot, 1) / BARRIER_FANIN;
+    }
+    return slot_leaf;
+}
+
+// Complete the current phase and wake the threads waiting on it
+static void barrier_release(barrier_t* barrier, int value) {
+    int sense = 1 - atomic_load(&barrier->sense);
+
+    // Publish the phase's minimum before the waiters can see the flip
+    barrier->result[sense] = value;
+    atomic_store(&barrier->sense, sense);
+
+    // A thread about to park sees the flip or is counted here, so no wake-up is lost
+    if (atomic_load(&barrier->sleepers) > 0) {
+        barrier_wake_all(&barrier->sense);
+    }
+}
+
+// Take a subtree's minimum and make the node ready for the next phase
+static int barrier_complete(barrier_node_t* node, uint64_t state) {
+    int value = atomic_exchange(&node->min_value, INT_MAX);
+    atomic_fetch_sub(&node->state, BARRIER_ARRIVED(state));
+    return value;
+}
+
+// Arrive at a node, and on behalf of its subtree at the nodes above for as long as we are the last
+static void barrier_arrive(barrier_t* barrier, int index, int value) {
+    while (index >= 0) {
+        barrier_node_t* node = &barrier->nodes[index];
+
+        // Contribute the value before arriving, so the last arrival sees every value
+        int cur = atomic_load(&node->min_value);
+        while (value < cur && !atomic_compare_exchange_weak(&node->min_value, &cur, value)) {
         }
-    } else {
-        // Waiting on the current phase's condition variable
-        if (barrier->phase == 0) {
-            pthread_cond_wait(&barrier->cond1, &barrier->mutex);
-        } else {
-            pthread_cond_wait(&barrier->cond2, &barrier->mutex);
+
+        uint64_t state = atomic_fetch_add(&node->state, 1) + 1;
+        if (BARRIER_ARRIVED(state) != BARRIER_MEMBERS(state)) {
+            return;
         }
+        value = barrier_complete(node, state);
+        index = node->parent;
     }
-    pthread_mutex_unlock(&barrier->mutex);
+    barrier_release(barrier, value);
 }
 
-void barrier_done(barrier_t* barrier) {
-    pthread_mutex_lock(&barrier->mutex);
-    barrier->max_threads--;
-    if (barrier->cur_threads == barrier->max_threads) {
-        barrier->cur_threads = 0;
-        barrier->phase = 1 - barrier->phase;
-
-        if (barrier->phase == 0) {
-            pthread_cond_broadcast(&barrier->cond2);
-        } else {
-            pthread_cond_broadcast(&barrier->cond1);
+// Leave a node for good, leaving its parent too once the subtree is empty
+static void barrier_leave(barrier_t* barrier, int index) {
+    while (index >= 0) {
+        barrier_node_t* node = &barrier->nodes[index];
+        uint64_t state = atomic_fetch_sub(&node->state, BARRIER_MEMBER) - BARRIER_MEMBER;
+
+        if (BARRIER_MEMBERS(state) > 0) {
+            // If everyone else had already arrived, we were what the phase was waiting for
+            if (BARRIER_ARRIVED(state) == BARRIER_MEMBERS(state)) {
+                int value = barrier_complete(node, state);
+                if (node->parent < 0) {
+                    barrier_release(barrier, value);
+                } else {
+                    barrier_arrive(barrier, node->parent, value);
+                }
+            }
+            return;
         }
+        index = node->parent;
+    }
+}
+
+void barrier_wait(barrier_t* barrier) {
+    // A plain wait takes part in the phase without lowering its minimum
+    barrier_reduce_min(barrier, INT_MAX);
+}
+
+int barrier_reduce_min(barrier_t* barrier, int value) {
+    // A lone thread is the whole phase, there is nobody to combine with or to wake
+    if (barrier->single) {
+        return value;
     }
-    pthread_mutex_unlock(&barrier->mutex);
-}
\ No newline at end of file
+
+    // The phase cannot complete before we arrive, so this is the sense we wait to see flipped
+    int sense = atomic_load(&barrier->sense);
+    barrier_arrive(barrier, barrier_leaf(barrier), value);
+
+    // Spin briefly, then park on the sense flag
+    for (int i = 0; i < barrier->spin && atomic_load(&barrier->sense) == sense; i++) {
+        barrier_pause();
+    }
+    if (atomic_load(&barrier->sense) == sense) {
+        atomic_fetch_add(&barrier->sleepers, 1);
+        while (atomic_load(&barrier->sense) == sense) {
+            barrier_park(&barrier->sense, sense);
+        }
+        atomic_fetch_sub(&barrier->sleepers, 1);
+    }
+
+    // The next phase cannot complete before we join it, so the result is still ours
+    return barrier->result[1 - sense];
+}
+
+void barrier_done(barrier_t* barrier) {
+    if (barrier->single) {
+        return;
+    }
+    barrier_leave(barrier, barrier_leaf(barrier));
+}
+
+void barrier_destroy(barrier_t* barrier) {
+    free(barrier->nodes);
+    barrier->nodes = NULL;
+    barrier->num_nodes = 0;
+}
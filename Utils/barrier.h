@@ -5,16 +5,37 @@
 #ifndef PROSIM_BARRIER_H
 #define PROSIM_BARRIER_H
 #include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define BARRIER_CACHE_LINE 64
+#define BARRIER_FANIN 4         // threads, or subtrees, combined at each node of the tree
+#define BARRIER_SPIN 4000       // polls of the sense flag before a waiting thread parks
+
+// A node of the combining tree. Threads arrive at a leaf, and the last arrival at a node
+// arrives at its parent on behalf of the whole subtree. Each node sits on its own cache line.
+typedef struct _barrier_node{
+    _Alignas(BARRIER_CACHE_LINE) _Atomic uint64_t state;  // members in the high half, arrivals this phase in the low half
+    _Atomic int min_value;      // smallest value contributed in the subtree this phase
+    int parent;                 // index of the parent node, -1 at the root
+} barrier_node_t;
 
 typedef struct _barrier{
-    pthread_mutex_t mutex;
-    pthread_cond_t cond1, cond2;
-    int max_threads, cur_threads;
-    int phase;
+    _Alignas(BARRIER_CACHE_LINE) _Atomic int sense;    // flipped by the thread that completes a phase
+    _Atomic int sleepers;       // threads parked on the sense flag
+    int result[2];              // minimum of the last phase that flipped the sense to each value
+    _Alignas(BARRIER_CACHE_LINE) barrier_node_t* nodes;
+    int num_nodes;
+    _Atomic int next_slot;      // hands each thread its place among the leaves on first use
+    int spin;
+    int single;                 // only one thread takes part, so each phase completes as it arrives
 } barrier_t;
 
 void barrier_init(barrier_t* barrier, int n);
 void barrier_wait(barrier_t* barrier);
+int barrier_reduce_min(barrier_t* barrier, int value);
 void barrier_done(barrier_t* barrier);
+void barrier_destroy(barrier_t* barrier);
 
 #endif //PROSIM_BARRIER_H
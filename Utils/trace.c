@@ -0,0 +1,587 @@
+//
+// Events the simulation outputs, as text and in a compact binary trace
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static const char *states[] = {"new", "ready", "running", "blocked", "receiving", "finished"};
+
+/* Longest record, a code and six numbers of at most 5 bytes each
+ */
+#define TRACE_RECORD_MAX 32
+
+/* The compression finds repeats of at least this many bytes, through a hash table of this many bits
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+/* Format a number like printf's %.*d
+ * @params:
+ *   out   : where to put the text
+ *   value : the number
+ *   digits: minimum number of digits, padded with zeros
+ * @returns:
+ *   the end of the text
+ */
+static char *trace_int(char *out, int value, int digits) {
+    char text[16];
+    int len = 0;
+    unsigned magnitude = value < 0 ? -(unsigned)value : (unsigned)value;
+
+    do {
+        text[len++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    while (len < digits) {
+        text[len++] = '0';
+    }
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (len > 0) {
+        *out++ = text[--len];
+    }
+    return out;
+}
+
+/* Copy text
+ * @params:
+ *   out : where to put the text
+ *   text: the text
+ * @returns:
+ *   the end of the text
+ */
+static char *trace_text(char *out, const char *text) {
+    while (*text) {
+        *out++ = *text++;
+    }
+    return out;
+}
+
+/* Lines are formatted by hand since this is where most of the time of a traced run goes
+ */
+char *trace_format(trace_event *event, char *out) {
+    switch (event->code) {
+    case EVENT_WAITING:
+        out = trace_int(trace_text(out, "Thread "), event->node, 1);
+        out = trace_text(out, " waiting...\n");
+        break;
+    case EVENT_CLOCK:
+        out = trace_int(trace_text(out, "Thread "), event->node, 1);
+        out = trace_int(trace_text(out, ", Clock = "), event->time, 2);
+        *out++ = '\n';
+        break;
+    case EVENT_COMPLETE:
+        out = trace_int(trace_text(out, "Thread "), event->node, 1);
+        out = trace_text(out, " complete\n");
+        break;
+    case EVENT_DEADLOCKED:
+        out = trace_int(trace_text(out, "Thread "), event->node, 1);
+        out = trace_text(out, " deadlocked\n");
+        break;
+    case EVENT_UNKNOWN_RECEIVER:
+        out = trace_int(trace_text(out, "error, process "), event->pid, 1);
+        out = trace_int(trace_text(out, " sent to unknown process "), event->arg, 1);
+        *out++ = '\n';
+        break;
+    case EVENT_UNNAMED_SENDER:
+        out = trace_int(trace_text(out, "error, process "), event->pid, 1);
+        out = trace_int(trace_text(out, " cannot be named, its message to "), event->arg, 1);
+        out = trace_text(out, " is dropped\n");
+        break;
+    case EVENT_BARRIER:
+        out = trace_int(trace_text(out, "Thread "), event->node, 1);
+        out = trace_int(trace_text(out, " at barrier, next event "), event->arg, 2);
+        *out++ = '\n';
+        break;
+    case EVENT_ENQUEUED:
+    case EVENT_DEQUEUED:
+        *out++ = '[';
+        out = trace_int(out, event->node, 2);
+        out = trace_int(trace_text(out, "] "), event->time, 5);
+        out = trace_int(trace_text(out, ": process "), event->pid, 1);
+        if (event->code == EVENT_ENQUEUED) {
+            out = trace_int(trace_text(out, " enqueued, priority "), event->arg, 1);
+        } else {
+            out = trace_int(trace_text(out, " dequeued, waited "), event->arg, 1);
+        }
+        *out++ = '\n';
+        break;
+    default:
+        *out++ = '[';
+        out = trace_int(out, event->node, 2);
+        out = trace_int(trace_text(out, "] "), event->time, 5);
+        out = trace_int(trace_text(out, ": process "), event->pid, 1);
+        *out++ = ' ';
+        out = trace_text(out, states[event->code]);
+        *out++ = '\n';
+        break;
+    }
+    return out;
+}
+
+char *trace_format_summary(trace_summary *summary, char *out) {
+    out = trace_int(trace_text(out, "| "), summary->finished, 5);
+    out = trace_int(trace_text(out, " | Proc "), summary->node, 2);
+    out = trace_int(trace_text(out, "."), summary->pid, 2);
+    out = trace_int(trace_text(out, " | Run "), summary->run, 1);
+    out = trace_int(trace_text(out, ", Block "), summary->block, 1);
+    out = trace_int(trace_text(out, ", Wait "), summary->wait, 1);
+    *out++ = '\n';
+    return out;
+}
+
+/* Check whether the records with a code have an argument
+ * @params:
+ *   code: the code of the record
+ * @returns:
+ *   1 if they do, 0 otherwise
+ */
+static int has_arg(int code) {
+    return code == EVENT_UNKNOWN_RECEIVER || code == EVENT_BARRIER ||
+           code == EVENT_ENQUEUED || code == EVENT_DEQUEUED || code == EVENT_UNNAMED_SENDER;
+}
+
+/* Append a number in as few bytes as it takes, small ones of either sign taking one byte
+ * @params:
+ *   out  : where to put the number
+ *   value: the number
+ * @returns:
+ *   the end of the number
+ */
+static unsigned char *put_varint(unsigned char *out, int value) {
+    unsigned bits = ((unsigned)value << 1) ^ (unsigned)(value >> 31);
+    while (bits >= 0x80) {
+        *out++ = (unsigned char)(bits | 0x80);
+        bits >>= 7;
+    }
+    *out++ = (unsigned char)bits;
+    return out;
+}
+
+/* Read a number written by put_varint
+ * @params:
+ *   in   : the bytes
+ *   pos  : position of the number, moved past it
+ *   len  : number of bytes there are
+ *   value: set to the number
+ * @returns:
+ *   1 if a whole number was read, 0 otherwise
+ */
+static int get_varint(const unsigned char *in, int *pos, int len, int *value) {
+    unsigned bits = 0;
+    for (int shift = 0; shift < 35 && *pos < len; shift += 7) {
+        unsigned char byte = in[(*pos)++];
+        bits |= (unsigned)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = (int)(bits >> 1) ^ -(int)(bits & 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Store a number as 4 bytes, little endian
+ * @params:
+ *   out  : where to put the number
+ *   value: the number
+ * @returns:
+ *   none
+ */
+static void put_u32(unsigned char *out, unsigned value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+/* Read a number stored by put_u32
+ * @params:
+ *   in: the bytes
+ * @returns:
+ *   the number
+ */
+static unsigned get_u32(const unsigned char *in) {
+    return in[0] | (unsigned)in[1] << 8 | (unsigned)in[2] << 16 | (unsigned)in[3] << 24;
+}
+
+/* Append a length that does not fit in its 4 bits of a token, as a run of 255s and the rest
+ * @params:
+ *   out: where to put the length
+ *   len: what is left of the length after the 15 in the token
+ * @returns:
+ *   the end of the length
+ */
+static unsigned char *lz_put_length(unsigned char *out, int len) {
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = (unsigned char)len;
+    return out;
+}
+
+/* Append a run of literal bytes and the repeat that follows it
+ * A token has the number of literals in its high 4 bits and the length of the repeat less LZ_MIN_MATCH
+ * in its low 4 bits, with 15 meaning the length goes on after the token.
+ * @params:
+ *   out    : where to put the sequence
+ *   literal: the literal bytes
+ *   num    : number of literal bytes
+ *   offset : how far back the repeat is, 0 for the last sequence, which has no repeat
+ *   match  : length of the repeat
+ * @returns:
+ *   the end of the sequence
+ */
+static unsigned char *lz_put_sequence(unsigned char *out, const unsigned char *literal, int num,
+                                      int offset, int match) {
+    unsigned char *token = out++;
+    int extra = offset ? match - LZ_MIN_MATCH : 0;
+
+    *token = (unsigned char)((num < 15 ? num : 15) << 4 | (extra < 15 ? extra : 15));
+    if (num >= 15) {
+        out = lz_put_length(out, num - 15);
+    }
+    memcpy(out, literal, num);
+    out += num;
+    if (offset) {
+        *out++ = (unsigned char)offset;
+        *out++ = (unsigned char)(offset >> 8);
+        if (extra >= 15) {
+            out = lz_put_length(out, extra - 15);
+        }
+    }
+    return out;
+}
+
+/* Compress a block by replacing repeats of earlier bytes with references to them
+ * The trace repeats itself a lot, every tick every node has the same records with the same small differences,
+ * so a simple and fast scheme does well.
+ * @params:
+ *   table: hash table of 1 << LZ_HASH_BITS positions
+ *   in   : the block
+ *   len  : size of the block
+ *   out  : where to put the compressed block, with room for len + len / 255 + 16 bytes
+ * @returns:
+ *   size of the compressed block
+ */
+static int lz_compress(int *table, const unsigned char *in, int len, unsigned char *out) {
+    unsigned char *start = out;
+    int anchor = 0;
+    int ip = 0;
+
+    for (int i = 0; i < 1 << LZ_HASH_BITS; i++) {
+        table[i] = -1;
+    }
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        unsigned seq = get_u32(in + ip);
+        unsigned h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int ref = table[h];
+        table[h] = ip;
+
+        if (ref < 0 || ip - ref > 0xffff || get_u32(in + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        int match = LZ_MIN_MATCH;
+        while (ip + match < len && in[ref + match] == in[ip + match]) {
+            match++;
+        }
+        out = lz_put_sequence(out, in + anchor, ip - anchor, ip - ref, match);
+        ip += match;
+        anchor = ip;
+    }
+    out = lz_put_sequence(out, in + anchor, len - anchor, 0, 0);
+    return (int)(out - start);
+}
+
+/* Read a length written by lz_put_length
+ * @params:
+ *   in : the compressed block
+ *   pos: position of the length, moved past it
+ *   len: size of the compressed block
+ * @returns:
+ *   the length, or -1 if the block ends in the middle of it
+ */
+static int lz_get_length(const unsigned char *in, int *pos, int len) {
+    int total = 0;
+    for (;;) {
+        if (*pos >= len) {
+            return -1;
+        }
+        unsigned char byte = in[(*pos)++];
+        total += byte;
+        if (byte != 255) {
+            return total;
+        }
+    }
+}
+
+/* Decompress a block compressed by lz_compress
+ * @params:
+ *   in     : the compressed block
+ *   len    : size of the compressed block
+ *   out    : where to put the block
+ *   out_len: size of the block
+ * @returns:
+ *   1 if the block decompressed to exactly its size, 0 if it is damaged
+ */
+static int lz_decompress(const unsigned char *in, int len, unsigned char *out, int out_len) {
+    int ip = 0;
+    int op = 0;
+
+    while (ip < len) {
+        int token = in[ip++];
+
+        int num = token >> 4;
+        if (num == 15) {
+            int more = lz_get_length(in, &ip, len);
+            if (more < 0) {
+                return 0;
+            }
+            num += more;
+        }
+        if (num > len - ip || num > out_len - op) {
+            return 0;
+        }
+        memcpy(out + op, in + ip, num);
+        ip += num;
+        op += num;
+
+        /* The last sequence is literals only
+         */
+        if (ip == len) {
+            break;
+        }
+
+        if (len - ip < 2) {
+            return 0;
+        }
+        int offset = in[ip] | in[ip + 1] << 8;
+        ip += 2;
+        int match = token & 15;
+        if (match == 15) {
+            int more = lz_get_length(in, &ip, len);
+            if (more < 0) {
+                return 0;
+            }
+            match += more;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || match > out_len - op) {
+            return 0;
+        }
+
+        /* The repeat can overlap the bytes it produces, so copy a byte at a time
+         */
+        for (int i = 0; i < match; i++, op++) {
+            out[op] = out[op - offset];
+        }
+    }
+    return op == out_len;
+}
+
+/* Write out the block being filled, if there is anything in it
+ * @params:
+ *   writer: the trace writer
+ * @returns:
+ *   none
+ */
+static void trace_block_flush(trace_writer *writer) {
+    if (writer->len == 0) {
+        return;
+    }
+
+    unsigned char sizes[8];
+    unsigned char *data = writer->block;
+    int stored = writer->len;
+    if (writer->compress) {
+        int packed = lz_compress(writer->table, writer->block, writer->len, writer->packed);
+        if (packed < writer->len) {
+            data = writer->packed;
+            stored = packed;
+        }
+    }
+    put_u32(sizes, writer->len);
+    put_u32(sizes + 4, stored);
+    fwrite(sizes, 1, sizeof(sizes), writer->fout);
+    fwrite(data, 1, stored, writer->fout);
+
+    /* Every block starts over, so each one can be decoded by itself
+     */
+    writer->len = 0;
+    writer->last_time = 0;
+    writer->last_node = 0;
+}
+
+trace_writer *trace_writer_new(FILE *fout, int compress) {
+    /* Assume the allocations will be successful
+     */
+    trace_writer *writer = calloc(1, sizeof(trace_writer));
+    writer->fout = fout;
+    writer->compress = compress;
+    writer->block = malloc(TRACE_BLOCK_SIZE);
+    if (compress) {
+        writer->packed = malloc(TRACE_BLOCK_SIZE + TRACE_BLOCK_SIZE / 255 + 16);
+        writer->table = malloc((1 << LZ_HASH_BITS) * sizeof(int));
+    }
+
+    fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC) - 1, fout);
+    fputc(TRACE_VERSION, fout);
+    return writer;
+}
+
+/* Make sure a whole record fits in the block being filled
+ * @params:
+ *   writer: the trace writer
+ * @returns:
+ *   where the record goes
+ */
+static unsigned char *trace_record_start(trace_writer *writer) {
+    if (writer->len > TRACE_BLOCK_SIZE - TRACE_RECORD_MAX) {
+        trace_block_flush(writer);
+    }
+    return writer->block + writer->len;
+}
+
+void trace_write(trace_writer *writer, trace_event *event) {
+    unsigned char *out = trace_record_start(writer);
+    unsigned char *start = out;
+
+    *out++ = (unsigned char)event->code;
+    out = put_varint(out, event->time - writer->last_time);
+    out = put_varint(out, event->node - writer->last_node);
+    out = put_varint(out, event->pid);
+    if (has_arg(event->code)) {
+        out = put_varint(out, event->arg);
+    }
+    writer->last_time = event->time;
+    writer->last_node = event->node;
+    writer->len += (int)(out - start);
+}
+
+void trace_write_summary(trace_writer *writer, trace_summary *summary) {
+    unsigned char *out = trace_record_start(writer);
+    unsigned char *start = out;
+
+    *out++ = TRACE_SUMMARY_CODE;
+    out = put_varint(out, summary->finished);
+    out = put_varint(out, summary->node);
+    out = put_varint(out, summary->pid);
+    out = put_varint(out, summary->run);
+    out = put_varint(out, summary->block);
+    out = put_varint(out, summary->wait);
+    writer->len += (int)(out - start);
+}
+
+int trace_writer_close(trace_writer *writer) {
+    unsigned char end[8] = {0};
+
+    trace_block_flush(writer);
+    fwrite(end, 1, sizeof(end), writer->fout);
+    int result = fflush(writer->fout) == 0 && !ferror(writer->fout) ? 0 : -1;
+
+    free(writer->block);
+    free(writer->packed);
+    free(writer->table);
+    free(writer);
+    return result;
+}
+
+trace_reader *trace_reader_new(FILE *fin) {
+    char magic[sizeof(TRACE_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), fin) != sizeof(magic) ||
+            memcmp(magic, TRACE_MAGIC, sizeof(TRACE_MAGIC) - 1) != 0 ||
+            magic[sizeof(TRACE_MAGIC) - 1] != TRACE_VERSION) {
+        return NULL;
+    }
+
+    /* Assume the allocations will be successful
+     */
+    trace_reader *reader = calloc(1, sizeof(trace_reader));
+    reader->fin = fin;
+    reader->block = malloc(TRACE_BLOCK_SIZE);
+    reader->packed = malloc(TRACE_BLOCK_SIZE);
+    return reader;
+}
+
+/* Read the next block of a trace
+ * @params:
+ *   reader: the trace reader
+ * @returns:
+ *   TRACE_READ_EVENT if a block was read, TRACE_READ_END after the last block, TRACE_READ_ERROR otherwise
+ */
+static int trace_block_read(trace_reader *reader) {
+    unsigned char sizes[8];
+    if (fread(sizes, 1, sizeof(sizes), reader->fin) != sizeof(sizes)) {
+        return TRACE_READ_ERROR;
+    }
+    unsigned len = get_u32(sizes);
+    unsigned stored = get_u32(sizes + 4);
+    if (len == 0) {
+        return TRACE_READ_END;
+    }
+    if (len > TRACE_BLOCK_SIZE || stored > len) {
+        return TRACE_READ_ERROR;
+    }
+
+    unsigned char *data = stored < len ? reader->packed : reader->block;
+    if (fread(data, 1, stored, reader->fin) != stored) {
+        return TRACE_READ_ERROR;
+    }
+    if (stored < len && !lz_decompress(reader->packed, (int)stored, reader->block, (int)len)) {
+        return TRACE_READ_ERROR;
+    }
+    reader->len = (int)len;
+    reader->pos = 0;
+    reader->last_time = 0;
+    reader->last_node = 0;
+    return TRACE_READ_EVENT;
+}
+
+int trace_read(trace_reader *reader, trace_event *event, trace_summary *summary) {
+    if (reader->pos == reader->len) {
+        int result = trace_block_read(reader);
+        if (result != TRACE_READ_EVENT) {
+            return result;
+        }
+    }
+
+    unsigned char *in = reader->block;
+    int *pos = &reader->pos;
+    int len = reader->len;
+    int code = in[(*pos)++];
+
+    if (code == TRACE_SUMMARY_CODE) {
+        if (!get_varint(in, pos, len, &summary->finished) || !get_varint(in, pos, len, &summary->node) ||
+                !get_varint(in, pos, len, &summary->pid) || !get_varint(in, pos, len, &summary->run) ||
+                !get_varint(in, pos, len, &summary->block) || !get_varint(in, pos, len, &summary->wait)) {
+            return TRACE_READ_ERROR;
+        }
+        return TRACE_READ_SUMMARY;
+    }
+
+    int time;
+    int node;
+    if (code >= EVENT_LAST || !get_varint(in, pos, len, &time) || !get_varint(in, pos, len, &node) ||
+            !get_varint(in, pos, len, &event->pid)) {
+        return TRACE_READ_ERROR;
+    }
+    event->arg = 0;
+    if (has_arg(code) && !get_varint(in, pos, len, &event->arg)) {
+        return TRACE_READ_ERROR;
+    }
+    event->code = code;
+    event->time = reader->last_time += time;
+    event->node = reader->last_node += node;
+    return TRACE_READ_EVENT;
+}
+
+void trace_reader_close(trace_reader *reader) {
+    free(reader->block);
+    free(reader->packed);
+    free(reader);
+}
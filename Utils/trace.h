@@ -0,0 +1,177 @@
+//
+// Events the simulation outputs, as text and in a compact binary trace
+//
+
+#ifndef PROSIM_TRACE_H
+#define PROSIM_TRACE_H
+#include <stdio.h>
+
+/* What an event is about, the first codes are the states a process moves into
+ */
+enum {
+    EVENT_NEW = 0,
+    EVENT_READY,
+    EVENT_RUNNING,
+    EVENT_BLOCKED,
+    EVENT_RECEIVING,
+    EVENT_FINISHED,
+    EVENT_WAITING,           /* a node is done with the scheduling of a tick */
+    EVENT_CLOCK,             /* a node is done with a tick */
+    EVENT_COMPLETE,          /* all processes of a node are finished */
+    EVENT_DEADLOCKED,        /* processes of a node wait for messages that will never be sent */
+    EVENT_UNKNOWN_RECEIVER,  /* a process sent to an address with no process, given as the argument */
+    EVENT_BARRIER,           /* a node stopped for the other nodes, with its next event as the argument */
+    EVENT_ENQUEUED,          /* a process entered the ready queue, with its priority as the argument */
+    EVENT_DEQUEUED,          /* a process left the ready queue, with how long it waited as the argument */
+    EVENT_UNNAMED_SENDER,    /* a process whose id is too big to be named sent a message, with the receiver as the argument */
+    EVENT_LAST
+};
+
+/* A line of a node's output, kept as a fixed-size record until it is written out
+ */
+typedef struct trace_event {
+    int time;                /* tick of the event */
+    int node;                /* node id */
+    int pid;                 /* process id, 0 for the node's own events */
+    int code;                /* what happened */
+    int arg;                 /* detail of the event, if it has one */
+} trace_event;
+
+/* A line of the summary, the statistics of a finished process
+ */
+typedef struct trace_summary {
+    int finished;            /* tick the process finished */
+    int node;
+    int pid;
+    int run;                 /* ticks spent running */
+    int block;               /* ticks spent blocked */
+    int wait;                /* ticks spent in the ready queue */
+} trace_summary;
+
+/* Longest line an event or summary can make
+ */
+#define TRACE_LINE_MAX 96
+
+/* Binary trace files start with the magic and the version of the format, followed by blocks. Each block
+ * has its size before and after compression as 4 byte little endian numbers, and holds whole records.
+ * A block is stored as is if compressing it does not make it smaller, and an empty block ends the trace.
+ * A record is its code as one byte, then variable-length numbers: the time and the node as differences from
+ * the previous record of the block, the process id, and the argument for codes that have one. A summary
+ * record has code TRACE_SUMMARY_CODE and is followed by the fields of the summary, in order.
+ */
+#define TRACE_MAGIC "PSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_SIZE 65536
+#define TRACE_SUMMARY_CODE 255
+
+typedef struct trace_writer {
+    FILE *fout;
+    int compress;            /* compress the blocks */
+    unsigned char *block;    /* records of the block being filled */
+    int len;                 /* bytes used in the block */
+    unsigned char *packed;   /* the block after compression */
+    int *table;              /* positions of recently seen byte sequences, for the compression */
+    int last_time;           /* time of the block's last record */
+    int last_node;           /* node of the block's last record */
+} trace_writer;
+
+typedef struct trace_reader {
+    FILE *fin;
+    unsigned char *block;    /* the current block, after decompression */
+    int len;                 /* size of the block */
+    int pos;                 /* next record in the block */
+    unsigned char *packed;   /* the block as read from the file */
+    int last_time;
+    int last_node;
+} trace_reader;
+
+/* What trace_read found
+ */
+enum {
+    TRACE_READ_ERROR = -1,
+    TRACE_READ_END = 0,
+    TRACE_READ_EVENT,
+    TRACE_READ_SUMMARY
+};
+
+/* Format an event as a line of output
+ * @params:
+ *   event: the event
+ *   out  : where to put the line, with room for TRACE_LINE_MAX characters
+ * @returns:
+ *   the end of the line
+ */
+char *trace_format(trace_event *event, char *out);
+
+/* Format a line of the summary, the same as context_stats
+ * @params:
+ *   summary: the statistics of the process
+ *   out    : where to put the line, with room for TRACE_LINE_MAX characters
+ * @returns:
+ *   the end of the line
+ */
+char *trace_format_summary(trace_summary *summary, char *out);
+
+/* Start a binary trace
+ * @params:
+ *   fout    : file to write the trace to
+ *   compress: if true, compress the blocks of the trace
+ * @returns:
+ *   the trace writer
+ */
+trace_writer *trace_writer_new(FILE *fout, int compress);
+
+/* Add an event to a binary trace
+ * @params:
+ *   writer: the trace writer
+ *   event : the event
+ * @returns:
+ *   none
+ */
+void trace_write(trace_writer *writer, trace_event *event);
+
+/* Add a line of the summary to a binary trace
+ * @params:
+ *   writer : the trace writer
+ *   summary: the statistics of the process
+ * @returns:
+ *   none
+ */
+void trace_write_summary(trace_writer *writer, trace_summary *summary);
+
+/* Finish a binary trace and free the writer, the file is flushed but left open
+ * @params:
+ *   writer: the trace writer
+ * @returns:
+ *   0 if the whole trace was written, -1 otherwise
+ */
+int trace_writer_close(trace_writer *writer);
+
+/* Start reading a binary trace
+ * @params:
+ *   fin: file to read the trace from
+ * @returns:
+ *   the trace reader, or NULL if the file is not a trace of this version
+ */
+trace_reader *trace_reader_new(FILE *fin);
+
+/* Read the next record of a binary trace
+ * @params:
+ *   reader : the trace reader
+ *   event  : set if the record is an event
+ *   summary: set if the record is a line of the summary
+ * @returns:
+ *   TRACE_READ_EVENT or TRACE_READ_SUMMARY, TRACE_READ_END at the end of the trace,
+ *   or TRACE_READ_ERROR if the trace is damaged or cut short
+ */
+int trace_read(trace_reader *reader, trace_event *event, trace_summary *summary);
+
+/* Free a trace reader, the file is left open
+ * @params:
+ *   reader: the trace reader
+ * @returns:
+ *   none
+ */
+void trace_reader_close(trace_reader *reader);
+
+#endif //PROSIM_TRACE_H
@@ -0,0 +1,164 @@
+//
+// Worker pool for running per-node tasks in phases
+//
+
+#include <assert.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include "workers.h"
+#include "barrier.h"
+#include "../Data Structures/WorkDeque.h"
+
+typedef struct worker_pool worker_pool;
+
+typedef struct worker {
+    worker_pool *pool;
+    int index;
+    WorkDeque *deque;        /* tasks of the current phase */
+    void **live;             /* tasks this worker ran that carry on to the next phase */
+    int num_live;
+    pthread_t tid;
+} worker;
+
+struct worker_pool {
+    worker *workers;
+    int num_workers;
+    workers_task_fn fn;
+    workers_serial_fn serial;
+    int interval;
+    barrier_t barrier;       /* ends a phase, among the workers only */
+};
+
+/* Find a task in another worker's deque
+ * @params:
+ *   self: the worker looking for a task
+ * @returns:
+ *   a stolen task, or NULL once every other deque is empty
+ */
+static void *steal_task(worker *self) {
+    worker_pool *pool = self->pool;
+
+    for (int i = 1; i < pool->num_workers; i++) {
+        worker *victim = &pool->workers[(self->index + i) % pool->num_workers];
+
+        /* A failed steal only means another thread took that task, so try again while there are more
+         */
+        while (!wd_is_empty(victim->deque)) {
+            void *task = wd_steal(victim->deque);
+            if (task != NULL) {
+                return task;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Worker thread
+ * @params:
+ *   arg : the worker
+ * @returns:
+ *   NULL
+ */
+static void *worker_main(void *arg) {
+    worker *self = arg;
+    worker_pool *pool = self->pool;
+    int global = INT_MAX;
+    int serial_at = 0;
+
+    for (;;) {
+        /* The tasks a worker ran last phase are queued on it again, so they stay put unless stolen
+         */
+        for (int i = 0; i < self->num_live; i++) {
+            wd_push(self->deque, self->live[i]);
+        }
+        self->num_live = 0;
+
+        int local = INT_MAX;
+        void *task;
+        while ((task = wd_pop(self->deque)) != NULL || (task = steal_task(self)) != NULL) {
+            int value = INT_MAX;
+            if (pool->fn(task, global, &value)) {
+                self->live[self->num_live++] = task;
+
+                /* A live task contributes at most INT_MAX - 1, so the minimum says whether any task is left
+                 */
+                if (value > INT_MAX - 1) {
+                    value = INT_MAX - 1;
+                }
+                if (value < local) {
+                    local = value;
+                }
+            }
+        }
+
+        /* Every task of the phase has run once all workers get past the barrier
+         */
+        global = barrier_reduce_min(&pool->barrier, local);
+        if (global == INT_MAX) {
+            return NULL;
+        }
+
+        /* Every worker sees the same minimums, so they all agree on when to stop for a serial step
+         * without talking to each other. The first worker runs it and the others wait for it at the barrier.
+         */
+        if (pool->serial != NULL && global - serial_at >= pool->interval) {
+            if (self->index == 0) {
+                pool->serial();
+            }
+            barrier_wait(&pool->barrier);
+            serial_at = global;
+        }
+    }
+}
+
+void workers_run(void **tasks, int num_tasks, int num_workers, workers_task_fn fn,
+                 workers_serial_fn serial, int interval) {
+    worker_pool pool;
+
+    if (num_workers > num_tasks) {
+        num_workers = num_tasks;
+    }
+    if (num_workers < 1) {
+        return;
+    }
+
+    pool.num_workers = num_workers;
+    pool.fn = fn;
+    pool.serial = serial;
+    pool.interval = interval;
+    barrier_init(&pool.barrier, num_workers);
+
+    /* Deal the tasks out round robin, any worker may end up holding all of them after stealing
+     * Assume the allocations will be successful
+     */
+    pool.workers = calloc(num_workers, sizeof(worker));
+    for (int i = 0; i < num_workers; i++) {
+        pool.workers[i].pool = &pool;
+        pool.workers[i].index = i;
+        pool.workers[i].deque = wd_init(num_tasks);
+        pool.workers[i].live = calloc(num_tasks, sizeof(void *));
+    }
+    for (int i = 0; i < num_tasks; i++) {
+        worker *w = &pool.workers[i % num_workers];
+        w->live[w->num_live++] = tasks[i];
+    }
+
+    /* Create workers and assume creation will be successful (or just die)
+     */
+    for (int i = 0; i < num_workers; i++) {
+        int result = pthread_create(&pool.workers[i].tid, NULL, worker_main, &pool.workers[i]);
+        assert(result == 0);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        int result = pthread_join(pool.workers[i].tid, NULL);
+        assert(result == 0);
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        wd_destroy(pool.workers[i].deque);
+        free(pool.workers[i].live);
+    }
+    free(pool.workers);
+    barrier_destroy(&pool.barrier);
+}
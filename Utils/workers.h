@@ -0,0 +1,36 @@
+//
+// Worker pool for running per-node tasks in phases
+//
+
+#ifndef PROSIM_WORKERS_H
+#define PROSIM_WORKERS_H
+
+/* A phase task is run once per phase for as long as it stays live.
+ * It gets the minimum of the values the live tasks contributed in the previous phase (INT_MAX in the
+ * first phase), contributes its own value through *value, and returns 0 once it is finished.
+ * Values are capped at INT_MAX - 1, which is what the task gets if no live task contributed less.
+ */
+typedef int (*workers_task_fn)(void *task, int global, int *value);
+
+/* A serial step is run by one worker between two phases, while no task is running.
+ */
+typedef void (*workers_serial_fn)(void);
+
+/* Run tasks in phases on a fixed number of worker threads
+ * Every live task runs once per phase, and a phase ends when all of them have. Workers take
+ * tasks from their own deque and steal from the others' once it is empty.
+ * @params:
+ *   tasks      : the tasks
+ *   num_tasks  : number of tasks
+ *   num_workers: number of worker threads to use
+ *   fn         : runs one task for one phase
+ *   serial     : if not NULL, run between phases whenever the minimum has gone up by at least interval
+ *                since it last ran
+ *   interval   : how far the minimum goes up between serial steps
+ * @returns:
+ *   none, returns once every task is finished
+ */
+void workers_run(void **tasks, int num_tasks, int num_workers, workers_task_fn fn,
+                 workers_serial_fn serial, int interval);
+
+#endif //PROSIM_WORKERS_H
@@ -0,0 +1,149 @@
+//
+// Measures barrier phases (ticks) per second against the number of threads, every thread calling
+// barrier_reduce_min in a loop. The mutex and condition variable barrier that barrier.c replaced is
+// measured the same way for comparison.
+//
+// Build from the top of the tree:
+//   gcc -O2 -pthread -I. -o barrier_bench bench/barrier_bench.c Utils/barrier.c
+// Run as: barrier_bench [ticks [threads...]]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "Utils/barrier.h"
+
+/* The barrier before the combining tree: one mutex and a condition variable per phase
+ */
+typedef struct mutex_barrier {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond[2];
+    int max_threads;
+    int cur_threads;
+    int phase;
+    int min_value;
+    int result[2];
+} mutex_barrier;
+
+static void mutex_barrier_init(mutex_barrier *barrier, int n) {
+    pthread_mutex_init(&barrier->mutex, NULL);
+    pthread_cond_init(&barrier->cond[0], NULL);
+    pthread_cond_init(&barrier->cond[1], NULL);
+    barrier->max_threads = n;
+    barrier->cur_threads = 0;
+    barrier->phase = 0;
+    barrier->min_value = INT_MAX;
+    barrier->result[0] = barrier->result[1] = INT_MAX;
+}
+
+static int mutex_barrier_reduce_min(mutex_barrier *barrier, int value) {
+    pthread_mutex_lock(&barrier->mutex);
+    if (value < barrier->min_value) {
+        barrier->min_value = value;
+    }
+
+    int phase = barrier->phase;
+    barrier->cur_threads++;
+    if (barrier->cur_threads == barrier->max_threads) {
+        barrier->cur_threads = 0;
+        barrier->phase = 1 - phase;
+        barrier->result[barrier->phase] = barrier->min_value;
+        barrier->min_value = INT_MAX;
+        pthread_cond_broadcast(&barrier->cond[phase]);
+    } else {
+        while (barrier->phase == phase) {
+            pthread_cond_wait(&barrier->cond[phase], &barrier->mutex);
+        }
+    }
+    int result = barrier->result[1 - phase];
+    pthread_mutex_unlock(&barrier->mutex);
+    return result;
+}
+
+/* What the threads of one measurement share
+ */
+typedef struct bench {
+    barrier_t tree;
+    mutex_barrier mutex;
+    int use_tree;            /* measure the combining tree, the mutex barrier otherwise */
+    long ticks;              /* phases each thread takes part in */
+} bench;
+
+static void *bench_thread(void *arg) {
+    bench *b = arg;
+    int value = (int)(pthread_self() & 0xffff);
+    for (long i = 0; i < b->ticks; i++) {
+        if (b->use_tree) {
+            value = barrier_reduce_min(&b->tree, value) + 1;
+        } else {
+            value = mutex_barrier_reduce_min(&b->mutex, value) + 1;
+        }
+    }
+    if (b->use_tree) {
+        barrier_done(&b->tree);
+    }
+    return NULL;
+}
+
+/* Run one measurement
+ * @params:
+ *   use_tree   : measure the combining tree rather than the mutex barrier
+ *   num_threads: number of threads taking part
+ *   ticks      : phases to run
+ * @returns:
+ *   phases per second
+ */
+static double measure(int use_tree, int num_threads, long ticks) {
+    bench b;
+    b.use_tree = use_tree;
+    b.ticks = ticks;
+    barrier_init(&b.tree, num_threads);
+    mutex_barrier_init(&b.mutex, num_threads);
+
+    /* Assume the allocation will be successful
+     */
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, bench_thread, &b);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    free(threads);
+    barrier_destroy(&b.tree);
+
+    double seconds = (double)(stop.tv_sec - start.tv_sec) + (double)(stop.tv_nsec - start.tv_nsec) / 1e9;
+    return (double)ticks / seconds;
+}
+
+int main(int argc, char **argv) {
+    long ticks = argc > 1 ? atol(argv[1]) : 20000;
+    if (ticks <= 0) {
+        fprintf(stderr, "Usage: %s [ticks [threads...]]\n", argv[0]);
+        return -1;
+    }
+
+    static const int default_threads[] = {1, 2, 4, 8, 16, 64, 256};
+    int num_counts = argc > 2 ? argc - 2 : (int)(sizeof(default_threads) / sizeof(default_threads[0]));
+
+    printf("threads   mutex/condvar ticks/s   tree ticks/s\n");
+    for (int i = 0; i < num_counts; i++) {
+        int num_threads = argc > 2 ? atoi(argv[i + 2]) : default_threads[i];
+        if (num_threads < 1) {
+            fprintf(stderr, "Bad thread count %s\n", argv[i + 2]);
+            return -1;
+        }
+
+        /* A single thread never waits, so it gets through many more ticks in the same time
+         */
+        long n = num_threads == 1 ? ticks * 1000 : ticks;
+        double mutex = measure(0, num_threads, n);
+        double tree = measure(1, num_threads, n);
+        printf("%7d   %21.0f   %12.0f\n", num_threads, mutex, tree);
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+//
+// Measures how many primitives per second context_next_op executes.
+//
+// Build from the top of the tree, once for each interpreter, and compare the two:
+//   gcc -O2 -pthread -I. -o interp_bench bench/interp_bench.c context.c Utils/workers.c Utils/barrier.c "Data Structures/WorkDeque.c"
+//   gcc -O2 -pthread -I. -DPROSIM_THREADED_CODE -o interp_bench_threaded bench/interp_bench.c context.c Utils/workers.c Utils/barrier.c "Data Structures/WorkDeque.c"
+// Run as: interp_bench [primitives [runs]]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "context.h"
+
+/* Programs that exercise the interpreter in different ways
+ */
+static const struct {
+    const char *name;
+    const char *text;
+} programs[] = {
+    {"LOOP 1000000 / DOOP / END",
+     "p 4 1 1\nLOOP 1000000\nDOOP 3\nEND\nHALT\n"},
+    {"nested loops, DOOP/BLOCK bodies",
+     "p 12 1 1\nLOOP 1000\nLOOP 50\nDOOP 1\nBLOCK 2\nEND\nDOOP 4\nLOOP 3\nBLOCK 1\nEND\nEND\nDOOP 1\nHALT\n"},
+    {"straight-line, one short loop",
+     "p 9 1 1\nDOOP 1\nBLOCK 2\nDOOP 3\nLOOP 2\nDOOP 1\nDOOP 2\nEND\nBLOCK 1\nHALT\n"},
+};
+
+/* Load a program from its text
+ * @params:
+ *   text: the program description
+ * @returns:
+ *   pointer to the new context or NULL if the program could not be loaded
+ */
+static context *load_program(const char *text) {
+    FILE *fin = fmemopen((void *)text, strlen(text), "r");
+    if (fin == NULL) {
+        return NULL;
+    }
+
+    context *cur = NULL;
+    context_input in;
+    if (context_input_open(&in, fin)) {
+        if (context_load_all(&in, &cur, 1, 1) < 1) {
+            cur = NULL;
+        }
+        context_input_close(&in);
+    }
+    fclose(fin);
+    return cur;
+}
+
+/* Execute a number of primitives, starting the program over whenever it halts
+ * @params:
+ *   cur       : the program
+ *   primitives: how many primitives to execute
+ * @returns:
+ *   seconds it took
+ */
+static double run(context *cur, long primitives) {
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < primitives; i++) {
+        if (context_next_op(cur) <= 0) {
+            cur->ip = -1;
+            cur->depth = 0;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    return (double)(stop.tv_sec - start.tv_sec) + (double)(stop.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    long primitives = argc > 1 ? atol(argv[1]) : 200000000L;
+    int runs = argc > 2 ? atoi(argv[2]) : 7;
+    if (primitives <= 0 || runs <= 0) {
+        fprintf(stderr, "Usage: %s [primitives [runs]]\n", argv[0]);
+        return -1;
+    }
+
+#ifdef PROSIM_THREADED_CODE
+    const char *interpreter = "threaded";
+#else
+    const char *interpreter = "switch";
+#endif
+    printf("%s interpreter, best of %d runs of %ld primitives\n", interpreter, runs, primitives);
+
+    for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++) {
+        context *cur = load_program(programs[p].text);
+        if (cur == NULL) {
+            fprintf(stderr, "Could not load program %s\n", programs[p].name);
+            return -1;
+        }
+
+        double best = 0;
+        for (int r = 0; r < runs; r++) {
+            double seconds = run(cur, primitives);
+            if (r == 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+        printf("  %-32s %8.1f M primitives/s\n", programs[p].name, (double)primitives / best / 1e6);
+    }
+    return 0;
+}
@@ -4,99 +4,823 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "context.h"
+#include "Utils/workers.h"
 
 static const char *OPS [] = {"HALT", "DOOP", "LOOP", "END", "BLOCK", "SEND", "RECV", NULL};
 
-/* Move the instruction pointer to the next DOOP, BLOCK or HALT to be executed.
+/* context_load_all parses the programs itself below this many, and gives each worker about this many chunks
+ */
+#define LOAD_PARALLEL_MIN 64
+#define LOAD_CHUNKS_PER_WORKER 4
+
+/* A workload cache starts with a header that says which text it was made from, followed by a record for
+ * each program and then the programs' primitives and loop summaries. Records refer to the arrays by their
+ * offset in the file, so the file can be mapped anywhere and the arrays used where they are.
+ */
+#define CACHE_MAGIC "PSCACHE"
+#define CACHE_VERSION 2
+#define CACHE_BYTE_ORDER 0x01020304
+
+typedef struct cache_header {
+    char magic[8];              /* CACHE_MAGIC */
+    int version;                /* CACHE_VERSION */
+    int byte_order;             /* CACHE_BYTE_ORDER as written by the machine that made the cache */
+    int opcode_size;            /* sizes of the structures in the file, which must match this build's */
+    int summary_size;
+    int program_size;
+    int num_procs;              /* number of programs */
+    uint64_t hash;              /* hash of the text the programs were loaded from */
+    uint64_t check;             /* hash of the rest of the file, to catch a damaged cache */
+} cache_header;
+
+typedef struct cache_program {
+    char name[11];
+    int size;
+    int priority;
+    int thread;
+    int num_loops;
+    int max_depth;
+    long code;                  /* offset of the primitives in the file */
+    long summaries;             /* offset of the loop summaries in the file, num_loops + 1 of them */
+} cache_program;
+
+/* A run of programs parsed by one task of context_load_all
+ */
+typedef struct load_chunk {
+    const char **starts;        /* where each program starts in the text */
+    const char *end;            /* end of the text */
+    context **procs;            /* where the contexts go */
+    int first;                  /* first program of the chunk */
+    int last;                   /* one past the last program of the chunk */
+    int failed;                 /* first program of the chunk with an error, -1 if there is none */
+} load_chunk;
+
+/* Find the op code of a primitive by its length and first character
+ * @params:
+ *   op : name of the primitive
+ *   len: length of the name
+ * @returns:
+ *   the op code, -1 if there is no such primitive
+ */
+static int op_lookup(const char *op, int len) {
+    int code = -1;
+    switch (len) {
+        case 3:
+            code = OP_END;
+            break;
+        case 4:
+            switch (op[0]) {
+                case 'H': code = OP_HALT; break;
+                case 'D': code = OP_DOOP; break;
+                case 'L': code = OP_LOOP; break;
+                case 'S': code = OP_SEND; break;
+                case 'R': code = OP_RECV; break;
+            }
+            break;
+        case 5:
+            code = OP_BLOCK;
+            break;
+    }
+    return code >= 0 && !memcmp(op, OPS[code], len) ? code : -1;
+}
+
+/* Check whether a primitive is followed by an argument
+ * @params:
+ *   op: op code of the primitive
+ * @returns:
+ *   1 if it is, 0 otherwise
+ */
+static int op_has_arg(int op) {
+    return op == OP_LOOP || op == OP_DOOP || op == OP_BLOCK || op == OP_SEND || op == OP_RECV;
+}
+
+/* Add the stops made by a piece of a loop body to the loop's summary
+ * The counts of deeply nested loops can overflow, so they saturate at LONG_MAX.
+ * @params:
+ *   sum  : summary of the enclosing loop's body
+ *   part : summary of the piece
+ *   times: number of times the piece is performed per iteration of the body, at least 1
+ * @returns:
+ *   none
+ */
+static void summary_add(loop_summary *sum, loop_summary *part, long times) {
+    long stops = part->stops > LONG_MAX / times ? LONG_MAX : part->stops * times;
+    sum->stops = stops > LONG_MAX - sum->stops ? LONG_MAX : sum->stops + stops;
+}
+
+/* Check the structure of a loaded program and precompute what the interpreter needs.
+ * LOOPs and ENDs must balance and loop counts must be positive.
+ * Every LOOP and END is linked to its partner, the deepest nesting is recorded,
+ * and the primitives one iteration of each loop body stops at are counted.
+ * @params:
+ *   cur : pointer to process context with its code and size loaded
+ *   ferr: FILE to which errors are reported, or NULL to not report them
+ * @returns:
+ *   1 if the program is valid, 0 if an error has occurred
+ */
+static int context_compile(context *cur, FILE *ferr) {
+    /* Number the loops first so the summaries can be allocated in one go,
+     * open holds the indices of LOOPs whose END has not been seen yet.
+     * We assume that the allocations will be successful.
+     */
+    cur->num_loops = 0;
+    for (int i = 0; i < cur->size; i++) {
+        if (cur->code[i].op == OP_LOOP) {
+            cur->code[i].loop = cur->num_loops++;
+        }
+    }
+    cur->summaries = calloc(cur->num_loops + 1, sizeof(loop_summary));
+    int *open = calloc(cur->num_loops + 1, sizeof(int));
+    int depth = 0;
+
+    for (int i = 0; i < cur->size; i++) {
+        opcode *code = &cur->code[i];
+        loop_summary prim = {1};
+
+        switch (code->op) {
+            case OP_LOOP:
+                if (code->arg <= 0) {
+                    if (ferr) {
+                        fprintf(ferr, "Bad input: Expecting positive loop count on line %d in %s\n",
+                                i + 1, cur->name);
+                    }
+                    free(open);
+                    return 0;
+                }
+                open[depth++] = i;
+                if (depth > cur->max_depth) {
+                    cur->max_depth = depth;
+                }
+                continue;
+            case OP_END:
+                if (depth == 0) {
+                    if (ferr) {
+                        fprintf(ferr, "Bad input: END without LOOP on line %d in %s\n",
+                                i + 1, cur->name);
+                    }
+                    free(open);
+                    return 0;
+                }
+
+                /* Link the pair, the body of this loop is now complete and the whole loop
+                 * is part of the body of the enclosing loop, if any.
+                 */
+                depth--;
+                code->jump = open[depth];
+                code->loop = cur->code[open[depth]].loop;
+                cur->code[open[depth]].jump = i;
+                if (depth > 0) {
+                    summary_add(&cur->summaries[cur->code[open[depth - 1]].loop],
+                                &cur->summaries[code->loop], cur->code[code->jump].arg);
+                }
+                continue;
+        }
+
+        /* Every other primitive stops the interpreter
+         */
+        if (depth > 0) {
+            summary_add(&cur->summaries[cur->code[open[depth - 1]].loop], &prim, 1);
+        }
+    }
+
+    if (depth > 0) {
+        if (ferr) {
+            fprintf(ferr, "Bad input: LOOP without END on line %d in %s\n",
+                    open[depth - 1] + 1, cur->name);
+        }
+        free(open);
+        return 0;
+    }
+
+    free(open);
+    return 1;
+}
+
+#ifdef PROSIM_THREADED_CODE
+/* Handlers of the threaded interpreter: one per primitive, followed by the superinstructions
+ */
+enum {
+    TH_LOOP_SKIP = OP_LAST, TH_LOOP_DOOP, TH_LOOP_BLOCK, TH_END_DOOP, TH_END_BLOCK, TH_UNKNOWN, TH_LAST
+};
+
+/* Direct-threaded version of context_next_op.
+ * Each primitive is executed by the handler whose address is stored for it, and every handler
+ * jumps straight to the handler of the primitive that follows, so there is no central switch.
  * @params:
  *   cur: pointer to process context
+ *   table: if not NULL, the handler addresses are stored here instead of executing anything
  * @returns:
- *   1 if DOOP or BLOCK is the next primitive.
+ *   1 if DOOP, BLOCK, SEND or RECV is the next primitive (or the table was requested).
  *   0 if HALT is the next primitive
  *   -1 is returned if an unknown primitive is encountered.
  */
-extern context *context_load(FILE *fin) {
+static int threaded_next_op(context *cur, const void *const **table) {
+    static const void *const handlers[TH_LAST] = {
+        [OP_HALT] = &&op_halt, [OP_DOOP] = &&op_doop, [OP_LOOP] = &&op_loop, [OP_END] = &&op_end,
+        [OP_BLOCK] = &&op_block, [OP_SEND] = &&op_send, [OP_RECV] = &&op_recv,
+        [TH_LOOP_SKIP] = &&op_loop_skip, [TH_LOOP_DOOP] = &&op_loop_doop, [TH_LOOP_BLOCK] = &&op_loop_block,
+        [TH_END_DOOP] = &&op_end_doop, [TH_END_BLOCK] = &&op_end_block, [TH_UNKNOWN] = &&op_unknown
+    };
+    opcode *code = cur->code;
+    loop_frame *frame;
+
+    if (table) {
+        *table = handlers;
+        return 1;
+    }
+
+#define NEXT() goto *threaded[++ip]
+#define ENTER_LOOP() \
+    frame = &cur->loops[cur->depth++]; \
+    frame->count = code[ip].arg
+#define REPEAT_LOOP(done) \
+    frame = &cur->loops[cur->depth - 1]; \
+    if (--frame->count == 0) { \
+        cur->depth--; \
+        done; \
+    }
+
+    /* Keep the instruction pointer in a local while dispatching and store it on the way out
+     */
+    const void **threaded = cur->threaded;
+    int ip = cur->ip;
+    NEXT();
+
+op_loop:
+    ENTER_LOOP();
+    NEXT();
+op_loop_doop:
+    ENTER_LOOP();
+    ip++;
+    goto op_doop;
+op_loop_block:
+    ENTER_LOOP();
+    ip++;
+    goto op_block;
+op_loop_skip:
+    ip = code[ip].jump;
+    NEXT();
+op_end:
+    REPEAT_LOOP(NEXT());
+    ip = code[ip].jump;
+    NEXT();
+op_end_doop:
+    REPEAT_LOOP(NEXT());
+    ip = code[ip].jump + 1;
+    goto op_doop;
+op_end_block:
+    REPEAT_LOOP(NEXT());
+    ip = code[ip].jump + 1;
+    goto op_block;
+op_doop:
+    cur->ip = ip;
+    cur->doop_count++;
+    cur->doop_time += code[ip].arg;
+    return 1;
+op_block:
+    cur->ip = ip;
+    cur->block_count++;
+    cur->block_time += code[ip].arg;
+    return 1;
+op_send:
+    cur->ip = ip;
+    cur->send_count++;
+    return 1;
+op_recv:
+    cur->ip = ip;
+    cur->recv_count++;
+    return 1;
+op_halt:
+    cur->ip = ip;
+    return 0;
+op_unknown:
+    cur->ip = ip;
+    printf("error, unknown opcode %d at ip %d\n", code[ip].op, ip);
+    return -1;
+
+#undef NEXT
+#undef ENTER_LOOP
+#undef REPEAT_LOOP
+}
+
+/* Translate a program into threaded form, choosing superinstructions where they apply:
+ *   LOOP followed by DOOP or BLOCK enters the loop and performs the primitive in one dispatch.
+ *   END whose loop body starts with DOOP or BLOCK repeats the body and performs it in one dispatch.
+ *   LOOP whose body never stops the interpreter jumps past its END.
+ * @params:
+ *   cur: pointer to process context, already compiled
+ * @returns:
+ *   none
+ */
+static void threaded_translate(context *cur) {
+    const void *const *handlers;
+    opcode *code = cur->code;
+
+    threaded_next_op(cur, &handlers);
+    for (int i = 0; i < cur->size; i++) {
+        int handler = code[i].op;
+
+        if (handler < 0 || handler >= OP_LAST) {
+            handler = TH_UNKNOWN;
+        } else if (code[i].op == OP_LOOP) {
+            if (cur->summaries[code[i].loop].stops == 0) {
+                handler = TH_LOOP_SKIP;
+            } else if (code[i + 1].op == OP_DOOP) {
+                handler = TH_LOOP_DOOP;
+            } else if (code[i + 1].op == OP_BLOCK) {
+                handler = TH_LOOP_BLOCK;
+            }
+        } else if (code[i].op == OP_END) {
+            if (code[code[i].jump + 1].op == OP_DOOP) {
+                handler = TH_END_DOOP;
+            } else if (code[code[i].jump + 1].op == OP_BLOCK) {
+                handler = TH_END_BLOCK;
+            }
+        }
+        cur->threaded[i] = handlers[handler];
+    }
+}
+#endif
+
+/* Check a loaded program and get it ready to run
+ * @params:
+ *   cur : pointer to process context with its code and size loaded
+ *   ferr: FILE to which errors are reported, or NULL to not report them
+ * @returns:
+ *   pointer to the context, which may have moved, or NULL if an error has occurred
+ */
+static context *context_finish(context *cur, FILE *ferr) {
+    if (!context_compile(cur, ferr)) {
+        return NULL;
+    }
+
+#ifdef PROSIM_THREADED_CODE
+    /* We assume that the allocation will be successful.
+     */
+    cur->threaded = calloc(cur->size, sizeof(void *));
+    threaded_translate(cur);
+#endif
+
+    /* Grow the context to hold a loop frame for each level of nesting.
+     * We assume that the reallocation will be successful.
+     */
+    cur = realloc(cur, context_size(cur));
+    return cur;
+}
+
+/* Check for the characters fscanf skips as whitespace
+ * @params:
+ *   c: the character
+ * @returns:
+ *   1 if c is whitespace, 0 otherwise
+ */
+static inline int input_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* Reads in a word from the input, skipping whitespace, like fscanf's %s with a width.
+ * What is left of a longer word is read next.
+ * @params:
+ *   in   : the input
+ *   word : set to the word
+ *   width: most characters to read, word has room for one more
+ * @returns:
+ *   length of the word, 0 if the input is used up
+ */
+static int input_word(context_input *in, char *word, int width) {
+    const char *pos = in->pos;
+    while (pos < in->end && input_space(*pos)) {
+        pos++;
+    }
+
+    int len = 0;
+    while (len < width && pos < in->end && !input_space(*pos)) {
+        word[len++] = *pos++;
+    }
+    word[len] = '\0';
+    in->pos = pos;
+    return len;
+}
+
+extern int context_input_int(context_input *in, int *value) {
+    const char *pos = in->pos;
+    while (pos < in->end && input_space(*pos)) {
+        pos++;
+    }
+
+    int negative = 0;
+    if (pos < in->end && (*pos == '-' || *pos == '+')) {
+        negative = *pos == '-';
+        pos++;
+    }
+    if (pos == in->end || *pos < '0' || *pos > '9') {
+        in->pos = pos;
+        return 0;
+    }
+
+    unsigned number = 0;
+    while (pos < in->end && *pos >= '0' && *pos <= '9') {
+        number = number * 10 + (unsigned)(*pos++ - '0');
+    }
+    *value = negative ? -(int)number : (int)number;
+    in->pos = pos;
+    return 1;
+}
+
+/* Reads in a program description from the input and creates a context for it.
+ * @params:
+ *   in  : the input
+ *   ferr: FILE to which errors are reported, or NULL to not report them
+ * @returns:
+ *   pointer to the new context or NULL if an error has occurred
+ */
+static context *context_parse(context_input *in, FILE *ferr) {
     /* Allocate new context and assume that it is successful,
      */
     context *cur = calloc(1, sizeof(context));
     assert(cur);
 
-    /* Read in the program description header and do some very basic validation
-     * We assume it will be correct for the most part.
-     */
     int size;
-    if (fscanf(fin, "%10s %d %d %d", cur->name, &size, &cur->priority, &cur->thread) < 4) {
-        fprintf(stderr, "Bad input: Expecting program name, size, priority, and thread\n");
+    if (!input_word(in, cur->name, 10) || !context_input_int(in, &size) ||
+            !context_input_int(in, &cur->priority) || !context_input_int(in, &cur->thread)) {
+        if (ferr) {
+            fprintf(ferr, "Bad input: Expecting program name, size, priority, and thread\n");
+        }
         return NULL;
     }
 
-    /* Allocate the primitive array and stack for the process.
-     * We assume that the allocations will be successful.
+    /* We assume that the allocation will be successful.
      */
-    cur->stack = stack_initialize(sizeof(int), "int");
     cur->code = calloc(size, sizeof(opcode));
-
-    /* ip = -1 because we assume that the next primitive to execute will be at index 0
-     */
+    cur->size = size;
     cur->ip = -1;
 
-    /* Read in the primitives with very basic validation
-    */
     for (int i = 0; i < size; i++) {
         char op[10];
+        int len = input_word(in, op, 9);
 
-        /* Since not all primitives have an argument, we have to read in the primitive first
-         */
-        if (fscanf(fin, "%9s", op) < 1) {
-            fprintf(stderr, "Bad input: Expecting operation on line %d in %s\n",
-                    i + 1, cur->name);
+        if (!len) {
+            if (ferr) {
+                fprintf(ferr, "Bad input: Expecting operation on line %d in %s\n", i + 1, cur->name);
+            }
             return NULL;
         }
 
-        /* Assume that we will find hte opcode in the OPS array
-         * This avoids needing a big IF statement.
-         * We use an if statement to identify which primitives have an argument
-         * Apart from checking that the argument is an integer, no validation is done.
-         */
-        cur->code[i].op = -1;
-        for (int j = 0; OPS[j]; j++) {
-            if (!strcmp(op, OPS[j])) {
-                cur->code[i].op = j;
-                if (j == OP_LOOP || j == OP_DOOP || j == OP_BLOCK || j == OP_SEND || j == OP_RECV) {
-                    if (fscanf(fin, "%d", &cur->code[i].arg) < 1) {
-                        fprintf(stderr, "Bad input: Expecting argument to op on line %d in %s\n",
-                                i + 1, cur->name);
-                        return NULL;
-                    }
-                }
-                break;
+        cur->code[i].op = op_lookup(op, len);
+        if (cur->code[i].op == -1) {
+            if (ferr) {
+                fprintf(ferr, "Bad input: operation %d unknown: %s\n", i + 1, op);
             }
+            return NULL;
         }
 
-        /* This is what happens if the Opcode is unknown.
-         */
-        if (cur->code[i].op == -1) {
-            fprintf(stderr, "Bad input: operation %d unknown: %s\n", i + 1, op);
+        if (op_has_arg(cur->code[i].op) && !context_input_int(in, &cur->code[i].arg)) {
+            if (ferr) {
+                fprintf(ferr, "Bad input: Expecting argument to op on line %d in %s\n", i + 1, cur->name);
+            }
             return NULL;
         }
     }
-    return cur;
+
+    return context_finish(cur, ferr);
 }
 
-/* Move the instruction pointer to the next DOOP, BLOCK or HALT to be executed and return the primitive.
+/* Skips over a program description in the input, reading just enough of it to find where it ends
+ * @params:
+ *   in: the input
+ * @returns:
+ *   1 if the program was skipped, 0 if it has an error that context_parse reports
+ */
+static int context_skip(context_input *in) {
+    char word[11];
+    int size;
+    int value;
+
+    if (!input_word(in, word, 10) || !context_input_int(in, &size) ||
+            !context_input_int(in, &value) || !context_input_int(in, &value)) {
+        return 0;
+    }
+    for (int i = 0; i < size; i++) {
+        int len = input_word(in, word, 9);
+        int op = len ? op_lookup(word, len) : -1;
+        if (op == -1 || (op_has_arg(op) && !context_input_int(in, &value))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Parse the programs of a chunk as a worker task
+ * @params:
+ *   task: the chunk
+ *   global, value: not used, the task only runs once
+ * @returns:
+ *   0, the task is finished
+ */
+static int load_task(void *task, int global, int *value) {
+    (void)global;
+    (void)value;
+    load_chunk *chunk = task;
+
+    for (int i = chunk->first; i < chunk->last; i++) {
+        context_input in = {chunk->starts[i], chunk->end, NULL, 0, 0};
+        chunk->procs[i] = context_parse(&in, NULL);
+        if (!chunk->procs[i]) {
+            chunk->failed = i;
+            break;
+        }
+    }
+    return 0;
+}
+
+extern int context_load_all(context_input *in, context **procs, int num_procs, int num_workers) {
+    /* Find where each program starts, stopping at the first one whose structure is broken
+     * We assume that the allocation will be successful.
+     */
+    const char **starts = calloc(num_procs + 1, sizeof(char *));
+    int found = 0;
+    while (found < num_procs) {
+        starts[found] = in->pos;
+        if (!context_skip(in)) {
+            break;
+        }
+        found++;
+    }
+
+    /* Parse the programs before that in parallel, without reporting errors
+     */
+    int failed = found;
+    if (num_workers > 1 && found >= LOAD_PARALLEL_MIN) {
+        int num_chunks = num_workers * LOAD_CHUNKS_PER_WORKER;
+        if (num_chunks > found) {
+            num_chunks = found;
+        }
+        load_chunk *chunks = calloc(num_chunks, sizeof(load_chunk));
+        void **tasks = calloc(num_chunks, sizeof(void *));
+        for (int i = 0; i < num_chunks; i++) {
+            chunks[i] = (load_chunk){starts, in->end, procs, (int)((long)found * i / num_chunks),
+                                     (int)((long)found * (i + 1) / num_chunks), -1};
+            tasks[i] = &chunks[i];
+        }
+        workers_run(tasks, num_chunks, num_workers, load_task, NULL, 0);
+        for (int i = 0; i < num_chunks; i++) {
+            if (chunks[i].failed >= 0) {
+                failed = chunks[i].failed;
+                break;
+            }
+        }
+        free(chunks);
+        free(tasks);
+    } else {
+        load_chunk chunk = {starts, in->end, procs, 0, found, -1};
+        load_task(&chunk, 0, NULL);
+        if (chunk.failed >= 0) {
+            failed = chunk.failed;
+        }
+    }
+
+    /* Parse the first program with an error again to report it, the same way as loading them one at a time would
+     */
+    if (failed < num_procs) {
+        context_input again = {starts[failed], in->end, NULL, 0, 0};
+        context_parse(&again, stderr);
+    }
+    free(starts);
+    return failed;
+}
+
+extern int context_input_open(context_input *in, FILE *fin) {
+    /* Map the file if it is a regular one, from where the FILE is at
+     */
+    struct stat info;
+    int fd = fileno(fin);
+    off_t offset = ftello(fin);
+    if (fd >= 0 && offset >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > offset) {
+        void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            in->data = map;
+            in->size = info.st_size;
+            in->mapped = 1;
+            in->pos = in->data + offset;
+            in->end = in->data + in->size;
+            return 1;
+        }
+    }
+
+    /* Otherwise read it all in
+     * We assume that the reallocations will be successful.
+     */
+    size_t max = 1 << 16;
+    in->data = malloc(max);
+    in->size = 0;
+    in->mapped = 0;
+    size_t got;
+    while ((got = fread(in->data + in->size, 1, max - in->size, fin)) > 0) {
+        in->size += got;
+        if (in->size == max) {
+            max *= 2;
+            in->data = realloc(in->data, max);
+        }
+    }
+    in->pos = in->data;
+    in->end = in->data + in->size;
+    return !ferror(fin);
+}
+
+extern void context_input_close(context_input *in) {
+    if (in->mapped) {
+        munmap(in->data, in->size);
+    } else {
+        free(in->data);
+    }
+    in->data = NULL;
+    in->pos = in->end = NULL;
+}
+
+/* Hash some bytes, FNV-1a over eight bytes at a time and then the tail a byte at a time, with the length mixed in
+ * @params:
+ *   bytes: the bytes
+ *   len  : how many there are
+ * @returns:
+ *   the hash
+ */
+static uint64_t hash_bytes(const char *bytes, size_t len) {
+    const uint64_t prime = 0x100000001b3ULL;
+    const char *end = bytes + len;
+    uint64_t hash = 0xcbf29ce484222325ULL ^ len;
+
+    for (; bytes + sizeof(uint64_t) <= end; bytes += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; bytes < end; bytes++) {
+        hash = (hash ^ (unsigned char)*bytes) * prime;
+    }
+    return hash ^ hash >> 32;
+}
+
+extern uint64_t context_input_hash(context_input *in) {
+    return hash_bytes(in->pos, in->end - in->pos);
+}
+
+/* Round an offset in the workload cache up to where a long can go
+ * @params:
+ *   offset: the offset
+ * @returns:
+ *   the rounded offset
+ */
+static long cache_align(long offset) {
+    return (offset + sizeof(long) - 1) & ~(long)(sizeof(long) - 1);
+}
+
+extern int context_cache_load(const char *path, uint64_t hash, context **procs, int num_procs) {
+    FILE *fin = fopen(path, "rb");
+    if (!fin) {
+        return 0;
+    }
+
+    /* Check that the cache was made by a build like this one from the same text before mapping it
+     */
+    cache_header header;
+    struct stat info;
+    if (fread(&header, sizeof(header), 1, fin) < 1 || fstat(fileno(fin), &info) != 0 ||
+            memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) || header.version != CACHE_VERSION ||
+            header.byte_order != CACHE_BYTE_ORDER || header.opcode_size != sizeof(opcode) ||
+            header.summary_size != sizeof(loop_summary) || header.program_size != sizeof(cache_program) ||
+            header.num_procs != num_procs || header.hash != hash ||
+            info.st_size < (long)(sizeof(header) + num_procs * sizeof(cache_program))) {
+        fclose(fin);
+        return 0;
+    }
+
+    /* The mapping is kept for the rest of the run, the contexts' primitives and summaries are in it
+     */
+    char *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(fin), 0);
+    fclose(fin);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    if (hash_bytes(data + sizeof(header), info.st_size - sizeof(header)) != header.check) {
+        munmap(data, info.st_size);
+        return 0;
+    }
+
+    /* Check every record against the size of the file before creating any context
+     */
+    cache_program *programs = (cache_program *)(data + sizeof(header));
+    for (int i = 0; i < num_procs; i++) {
+        cache_program *prog = &programs[i];
+        if (prog->size < 0 || prog->num_loops < 0 || prog->max_depth < 0 || prog->max_depth > prog->num_loops ||
+                prog->code < 0 || prog->code % sizeof(long) || prog->summaries < 0 || prog->summaries % sizeof(long) ||
+                prog->code + (long)prog->size * (long)sizeof(opcode) > info.st_size ||
+                prog->summaries + (long)(prog->num_loops + 1) * (long)sizeof(loop_summary) > info.st_size) {
+            munmap(data, info.st_size);
+            return 0;
+        }
+    }
+
+    /* Assume the allocations will be successful
+     */
+    for (int i = 0; i < num_procs; i++) {
+        cache_program *prog = &programs[i];
+        context *cur = calloc(1, sizeof(context) + prog->max_depth * sizeof(loop_frame));
+        memcpy(cur->name, prog->name, sizeof(cur->name));
+        cur->name[sizeof(cur->name) - 1] = '\0';
+        cur->size = prog->size;
+        cur->priority = prog->priority;
+        cur->thread = prog->thread;
+        cur->num_loops = prog->num_loops;
+        cur->max_depth = prog->max_depth;
+        cur->code = (opcode *)(data + prog->code);
+        cur->summaries = (loop_summary *)(data + prog->summaries);
+        cur->ip = -1;
+
+#ifdef PROSIM_THREADED_CODE
+        cur->threaded = calloc(cur->size, sizeof(void *));
+        threaded_translate(cur);
+#endif
+        procs[i] = cur;
+    }
+    return 1;
+}
+
+extern int context_cache_save(const char *path, uint64_t hash, context **procs, int num_procs) {
+    /* Lay the primitives of all programs out first, then the summaries
+     */
+    long offset = cache_align(sizeof(cache_header) + num_procs * sizeof(cache_program));
+    for (int i = 0; i < num_procs; i++) {
+        offset = cache_align(offset + procs[i]->size * sizeof(opcode));
+    }
+    for (int i = 0; i < num_procs; i++) {
+        offset = cache_align(offset + (procs[i]->num_loops + 1) * sizeof(loop_summary));
+    }
+
+    /* Build the whole cache in memory so the check can be computed before it is written
+     * Assume the allocation will be successful
+     */
+    char *data = calloc(1, offset);
+    cache_header *header = (cache_header *)data;
+    cache_program *programs = (cache_program *)(data + sizeof(cache_header));
+    offset = cache_align(sizeof(cache_header) + num_procs * sizeof(cache_program));
+    for (int i = 0; i < num_procs; i++) {
+        memcpy(programs[i].name, procs[i]->name, sizeof(programs[i].name));
+        programs[i].size = procs[i]->size;
+        programs[i].priority = procs[i]->priority;
+        programs[i].thread = procs[i]->thread;
+        programs[i].num_loops = procs[i]->num_loops;
+        programs[i].max_depth = procs[i]->max_depth;
+        programs[i].code = offset;
+        memcpy(data + offset, procs[i]->code, procs[i]->size * sizeof(opcode));
+        offset = cache_align(offset + procs[i]->size * sizeof(opcode));
+    }
+    for (int i = 0; i < num_procs; i++) {
+        programs[i].summaries = offset;
+        memcpy(data + offset, procs[i]->summaries, (procs[i]->num_loops + 1) * sizeof(loop_summary));
+        offset = cache_align(offset + (procs[i]->num_loops + 1) * sizeof(loop_summary));
+    }
+    *header = (cache_header){CACHE_MAGIC, CACHE_VERSION, CACHE_BYTE_ORDER, sizeof(opcode), sizeof(loop_summary),
+                             sizeof(cache_program), num_procs, hash,
+                             hash_bytes(data + sizeof(cache_header), offset - sizeof(cache_header))};
+
+    /* Write the cache under a name of its own and move it into place once it is complete,
+     * so that a run reading the cache never sees half of it.
+     */
+    char temp[FILENAME_MAX];
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+    FILE *fout = fopen(temp, "wb");
+    int ok = fout && fwrite(data, 1, offset, fout) == (size_t)offset;
+    free(data);
+
+    if (!fout || fclose(fout) != 0 || !ok || rename(temp, path) != 0) {
+        remove(temp);
+        return 0;
+    }
+    return 1;
+}
+
+/* Move the instruction pointer to the next DOOP, BLOCK, SEND, RECV or HALT to be executed and return the primitive.
  * @params:
  *   cur: pointer to process context
  * @returns:
- *   1 if DOOP or BLOCK is the next primitive.
+ *   1 if DOOP, BLOCK, SEND or RECV is the next primitive.
  *   0 if HALT is the next primitive
  *   -1 is returned if an unknown primitive is encountered.
  */
 extern int context_next_op(context *cur) {
-    int count;
+#ifdef PROSIM_THREADED_CODE
+    return threaded_next_op(cur, NULL);
+#else
+    loop_frame *frame;
 
-    /* Move the IP along until a DOOP, BLOCK, or HALT is encountered.
+    /* Move the IP along until a DOOP, BLOCK, SEND, RECV or HALT is encountered.
      * LOOPs and ENDs are handled inside the loop.
      * Statistics are updated depending on the primitive.
      */
@@ -104,11 +828,19 @@ extern int context_next_op(context *cur) {
         cur->ip++;
         switch (cur->code[cur->ip].op) {
             case OP_LOOP:
-                /* Use a stack to keep track of nested loops by pushing
-                 * the start of loop and number of iterations on the stack.
+                /* A loop whose body never stops the interpreter can be skipped as a whole.
                  */
-                stack_push(cur->stack, &cur->ip);
-                stack_push(cur->stack, &cur->code[cur->ip].arg);
+                if (cur->summaries[cur->code[cur->ip].loop].stops == 0) {
+                    cur->ip = cur->code[cur->ip].jump;
+                    break;
+                }
+
+                /* Use the loop frames to keep track of nested loops by recording
+                 * the number of iterations.
+                 */
+                frame = &cur->loops[cur->depth];
+                frame->count = cur->code[cur->ip].arg;
+                cur->depth++;
                 break;
             case OP_DOOP:
                 cur->doop_count++;
@@ -118,22 +850,26 @@ extern int context_next_op(context *cur) {
                 cur->block_count++;
                 cur->block_time += cur->code[cur->ip].arg;
                 return 1;
+            case OP_SEND:
+                cur->send_count++;
+                return 1;
+            case OP_RECV:
+                cur->recv_count++;
+                return 1;
             case OP_END:
-                /* The top of stack contains current loop info.
+                /* The innermost frame contains current loop info.
                  * Number of iterations is one-less now.
                  */
-                count = *(int*)stack_pop(cur->stack);
-                count--;
-                if (count == 0) {
-                    /* Stack needs to be cleared if the loop is done.
+                frame = &cur->loops[cur->depth - 1];
+                frame->count--;
+                if (frame->count == 0) {
+                    /* Frame needs to be dropped if the loop is done.
                      */
-                    stack_pop(cur->stack);
+                    cur->depth--;
                 } else {
-                    /* Stack needs to be updated with new count and
-                     * ip moved to start of loop body.
+                    /* ip moved to the LOOP, so the body starts again.
                      */
-                    cur->ip = *(int*)stack_peek(cur->stack);
-                    stack_push(cur->stack, &count);
+                    cur->ip = cur->code[cur->ip].jump;
                 }
                 break;
             case OP_HALT:
@@ -143,6 +879,7 @@ extern int context_next_op(context *cur) {
                 return -1;
         }
     }
+#endif
 }
 
 /* returns the duration of the current primitive.
@@ -167,6 +904,16 @@ extern int context_cur_op(context *cur) {
     return cur->code[cur->ip].op;
 }
 
+/* Returns the size of a process context, including its loop frames
+ * @params:
+ *   cur: pointer to process context
+ * @returns:
+ *   size of the context in bytes
+ */
+extern size_t context_size(context *cur) {
+    return sizeof(context) + cur->max_depth * sizeof(loop_frame);
+}
+
 /* Outputs aggregate statistics about a process to the specified file.
  * @params:
  *   cur: pointer to process context
@@ -6,7 +6,7 @@
 #define ASSIGNMENT_1_CONTEXT_H
 
 #include <stdio.h>
-#include "Data Structures/Stack.h"
+#include <stdint.h>
 
 enum {
     OP_HALT, OP_DOOP, OP_LOOP, OP_END, OP_BLOCK, OP_SEND, OP_RECV, OP_LAST
@@ -15,11 +15,31 @@ enum {
 typedef struct opcode {
     int op;                     /* primitive op code (see enum above) */
     int arg;                    /* argument value associated with the op code */
+    int jump;                   /* LOOP: index of its END, END: index of its LOOP */
+    int loop;                   /* LOOP and END: index of the loop's summary */
 } opcode;
 
+typedef struct loop_summary {
+    long stops;                 /* primitives that context_next_op stops at in one iteration, nested loops
+                                   included, LONG_MAX if there are more; a loop without any is skipped */
+} loop_summary;
+
+typedef struct loop_frame {
+    int count;                  /* number of iterations left, including the current one */
+} loop_frame;
+
+/* Building with PROSIM_THREADED_CODE (GCC or Clang) makes context_next_op a direct-threaded
+ * interpreter: loading a program translates the primitives into an array of handler addresses, with
+ * LOOPs and ENDs fused with the DOOP or BLOCK that starts their body where possible.
+ */
 typedef struct context {
     opcode *code;               /* array of primitives */
-    Stack *stack;                 /* stack for processing loops */
+    const void **threaded;      /* handler address for each primitive, with PROSIM_THREADED_CODE */
+    int size;                   /* number of primitives */
+    loop_summary *summaries;    /* per loop summary of its body, indexed by opcode.loop */
+    int num_loops;              /* number of loops in the program */
+    int depth;                  /* number of loops currently being executed */
+    int max_depth;              /* deepest nesting of loops in the program */
     char name[11];              /* program name */
     int ip;                     /* index of current primitive being executed */
     int id;                     /* process id */
@@ -37,25 +57,109 @@ typedef struct context {
     int recv_count;             /* number of receives done by this process */
     int thread;                 /* node id to which process is to be assigned */
     int finished;               /* time process finished */
+    int queued;                 /* order in which the process was last queued on its node */
+    loop_frame loops[];         /* frames of the loops being executed, innermost last, max_depth of them */
 } context;
 
-/* Move the instruction pointer to the next DOOP, BLOCK or HALT to be executed.
+/* Move the instruction pointer to the next DOOP, BLOCK, SEND, RECV or HALT to be executed.
  * @params:
  *   cur: pointer to process context
  * @returns:
- *   1 if DOOP or BLOCK is the next primitive.
+ *   1 if DOOP, BLOCK, SEND or RECV is the next primitive.
  *   0 if HALT is the next primitive
  *   -1 is returned if an unknown primitive is encountered.
  */
 extern int context_next_op(context *cur);
 
-/* Reads in a program description from a file and creates a context for it.
+/* A whole process description in memory, mapped from the file if possible and read in otherwise
+ */
+typedef struct context_input {
+    const char *pos;            /* next character to read */
+    const char *end;            /* end of the text */
+    char *data;                 /* the text */
+    size_t size;                /* size of the text */
+    int mapped;                 /* set if the text is mapped from the file */
+} context_input;
+
+/* Makes the rest of a file available for context_input_int and context_load_all.
+ * @params:
+ *   in : the input to set up
+ *   fin: FILE from which to read, which should not be read from directly afterwards
+ * @returns:
+ *   1 if the input is ready, 0 if the file could not be read
+ */
+extern int context_input_open(context_input *in, FILE *fin);
+
+/* Reads in an integer from the input, skipping whitespace, like fscanf's %d.
  * @params:
- *   fin: FILE from which to read
+ *   in   : the input
+ *   value: set to the integer
+ * @returns:
+ *   1 if an integer was read, 0 otherwise
+ */
+extern int context_input_int(context_input *in, int *value);
+
+/* Reads in a number of program descriptions from the input and creates contexts for them.
+ * The programs are parsed in parallel once their boundaries have been found, errors are reported
+ * to stderr, for the first program that has one.
+ * @params:
+ *   in         : the input
+ *   procs      : array in which to store the new contexts
+ *   num_procs  : number of programs to read
+ *   num_workers: number of threads to use
+ * @returns:
+ *   number of programs read before the first one with an error, num_procs if there is none
+ */
+extern int context_load_all(context_input *in, context **procs, int num_procs, int num_workers);
+
+/* Releases the input
+ * @params:
+ *   in: the input
+ * @returns:
+ *   none
+ */
+extern void context_input_close(context_input *in);
+
+/* Hashes what is left of the input, to tell whether a workload cache was made from the same text.
+ * @params:
+ *   in: the input, which is not advanced
+ * @returns:
+ *   the hash
+ */
+extern uint64_t context_input_hash(context_input *in);
+
+/* Creates contexts for the programs in a workload cache without parsing their text.
+ * The cache is mapped read-only and the contexts use the primitives and loop summaries in it directly,
+ * so it stays mapped for the rest of the run.
+ * @params:
+ *   path     : the cache file
+ *   hash     : context_input_hash of the text of the programs
+ *   procs    : array in which to store the new contexts
+ *   num_procs: number of programs
+ * @returns:
+ *   1 if the programs were loaded, 0 if there is no cache or it was made from other text or by another build
+ */
+extern int context_cache_load(const char *path, uint64_t hash, context **procs, int num_procs);
+
+/* Saves loaded programs in a workload cache for context_cache_load.
+ * @params:
+ *   path     : the cache file, which is replaced once the new one is complete
+ *   hash     : context_input_hash of the text the programs were loaded from
+ *   procs    : array of the contexts of the programs, before they run
+ *   num_procs: number of programs
+ * @returns:
+ *   1 if the cache was saved, 0 otherwise
+ */
+extern int context_cache_save(const char *path, uint64_t hash, context **procs, int num_procs);
+
+/* Returns the size of a process context, including its loop frames
+ * A copy of this many bytes holds the whole state of the process.
+ * @params:
+ *   cur: pointer to process context
  * @returns:
- *   pointer to the new context or NULL if an error has occurred
+ *   size of the context in bytes
  */
-extern context *context_load(FILE *fin);
+extern size_t context_size(context *cur);
 
 /* Outputs aggregate statistics about a process to the specified file.
  * @params:
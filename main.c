@@ -1,101 +1,192 @@
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 #include "context.h"
 #include "process.h"
-#include "Utils/barrier.h"
 
 static context **procs;
-barrier_t barrier;
-
-typedef struct thread_args {
-    int id;                /* Node id of thread */
-} thread_args;
-
-/* Node runner
- * @params:
- *   arg : node id of thread
- * @returns:
- *   NULL
- */
-static void *thread_runner(void *arg) {
-    thread_args *thd_arg = (thread_args *)arg;
-
-    processor_t *cpu = process_new();
-
-    for (int i = 0; procs[i]; i++) {
-        if (procs[i]->thread == thd_arg->id) {
-            process_admit(cpu, procs[i]);
-        }
-    }
-
-    process_simulate(cpu, thd_arg->id);
-
-    return NULL;
-}
 
 /* Main line
  * @params:
- *   None
+ *   argc, argv: command line options, -e selects the event-driven simulation,
+ *               -w sets the number of worker threads, -l the minimum message latency,
+ *               -t runs optimistically with nodes up to the given number of ticks ahead,
+ *               -v sets the trace level (0 for only the summary), -f only traces one node or node.pid,
+ *               -b writes the output to a binary trace file instead, compressed with -z,
+ *               -c loads the programs from a workload cache, which is made if it is missing or out of date
  * @returns:
  *   0
  */
-int main() {
+int main(int argc, char **argv) {
     int num_procs;
     int quantum;
     int num_threads;
-    thread_args *args;
+    int num_workers = 0;
+    int latency = 1;
+    int ahead = 0;
+    sim_mode_t mode = SIM_TICK;
+    trace_level_t level = TRACE_CLOCK;
+    int trace_node = 0;
+    int trace_pid = 0;
+    char *trace_file = NULL;
+    char *cache_file = NULL;
+    int compress = 0;
+
+    /* Parse the options, the process description itself always comes from stdin
+     */
+    int opt;
+    while ((opt = getopt(argc, argv, "ew:l:t:v:f:b:zc:")) != -1) {
+        switch (opt) {
+        case 'e':
+            mode = SIM_EVENT;
+            break;
+        case 'w':
+            num_workers = atoi(optarg);
+            break;
+        case 'l':
+            latency = atoi(optarg);
+            break;
+        case 't':
+            ahead = atoi(optarg);
+            break;
+        case 'v':
+            level = (trace_level_t)atoi(optarg);
+            break;
+        case 'f':
+            /* node, or node.pid
+             */
+            if (sscanf(optarg, "%d.%d", &trace_node, &trace_pid) < 1) {
+                trace_node = 0;
+            }
+            break;
+        case 'b':
+            trace_file = optarg;
+            break;
+        case 'z':
+            compress = 1;
+            break;
+        case 'c':
+            cache_file = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-e] [-w workers] [-l latency] [-t ahead] [-v level] [-f node[.pid]]"
+                            " [-b trace [-z]] [-c cache] < description\n", argv[0]);
+            return -1;
+        }
+    }
 
-    /* Read in the header of the process description with minimal validation
+    /* Take in the whole process description at once, then read its header with minimal validation
      */
-    if (scanf("%d %d %d", &num_procs, &quantum, &num_threads) < 3) {
+    context_input in;
+    if (!context_input_open(&in, stdin)) {
+        fprintf(stderr, "Bad input, could not read process description\n");
+        return -1;
+    }
+    if (!context_input_int(&in, &num_procs) || !context_input_int(&in, &quantum) ||
+            !context_input_int(&in, &num_threads)) {
         fprintf(stderr, "Bad input, expecting # of processes, quantum, and # of threads\n");
         return -1;
     }
 
     /* We use an array of pointers to contexts to track the processes.
-     * We also use an array of args for the nodes and an array for thread IDs
      */
     procs  = calloc(num_procs + 1, sizeof(context *));
-    args  = calloc(num_procs + 1, sizeof(thread_args));
-    pthread_t *tid = calloc(num_threads, sizeof(pthread_t));
 
-    barrier_init(&barrier, num_threads);
-    process_init(quantum);
+    process_init(quantum, mode, latency, ahead);
+    process_trace(level, trace_node, trace_pid);
 
-    /* Load each process, if an error occurs, we just give up.
+    /* Write a binary trace if asked to, giving up if it cannot be created
      */
-    for (int i = 0; i < num_procs; i++) {
-        procs[i] = context_load(stdin);
-        if (!procs[i]) {
-            fprintf(stderr, "Bad input, could not load program description\n");
+    FILE *trace = NULL;
+    if (trace_file != NULL) {
+        trace = fopen(trace_file, "wb");
+        if (!trace) {
+            fprintf(stderr, "Could not create trace file %s\n", trace_file);
             return -1;
         }
+        process_binary_trace(trace, compress);
     }
 
+    /* Simulate the nodes on one worker per core unless told otherwise, the workers load the processes too
+     */
+    if (num_workers < 1) {
+        num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
 
-    /* Create threads and assume creation will be successful (or just die)
+    /* Load each process from the cache if it was made from this description, otherwise parse them
+     * and make the cache. If an error occurs, we just give up.
      */
-    for (int i = 0; i < num_threads; i++) {
-        /* This is where we assign node ids
-         */
-        args[i].id = i + 1;
-        int result = pthread_create(&tid[i], NULL, thread_runner, &args[i]);
-        assert(result == 0);
+    uint64_t hash = cache_file ? context_input_hash(&in) : 0;
+    if (!cache_file || !context_cache_load(cache_file, hash, procs, num_procs)) {
+        if (context_load_all(&in, procs, num_procs, num_workers) < num_procs) {
+            fprintf(stderr, "Bad input, could not load program description\n");
+            return -1;
+        }
+        if (cache_file && !context_cache_save(cache_file, hash, procs, num_procs)) {
+            fprintf(stderr, "Could not write workload cache %s\n", cache_file);
+        }
     }
+    context_input_close(&in);
 
-    /* Wait for threads to complete and assume we will be successful (or just die)
+    /* Create the nodes and register their processes, all of them first since a process can send a message
+     * as soon as it is admitted, then admit the processes assigned to each node together.
+     * This is where we assign node ids
+     * Assume the allocation will be successful
      */
-    for (int i = 0; i < num_threads; i++) {
-        int result = pthread_join(tid[i], NULL);
-        assert(result == 0);
+    processor_t **cpus = calloc(num_threads + 1, sizeof(processor_t *));
+    for (int id = 1; id <= num_threads; id++) {
+        cpus[id] = process_new(id);
     }
 
+    /* Bucket the processes by node in one pass, keeping their order within each node,
+     * processes assigned to a node that does not exist are left out
+     */
+    int *first = calloc(num_threads + 2, sizeof(int));
+    for (int i = 0; procs[i]; i++) {
+        if (procs[i]->thread >= 1 && procs[i]->thread <= num_threads) {
+            first[procs[i]->thread + 1]++;
+        }
+    }
+    for (int id = 1; id <= num_threads; id++) {
+        first[id + 1] += first[id];
+    }
+
+    context **node_procs = calloc(num_procs + 1, sizeof(context *));
+    int *next = calloc(num_threads + 1, sizeof(int));
+    memcpy(next, first, (num_threads + 1) * sizeof(int));
+    for (int i = 0; procs[i]; i++) {
+        if (procs[i]->thread >= 1 && procs[i]->thread <= num_threads) {
+            node_procs[next[procs[i]->thread]++] = procs[i];
+        }
+    }
+    free(next);
+
+    for (int id = 1; id <= num_threads; id++) {
+        for (int i = first[id]; i < first[id + 1]; i++) {
+            if (!process_register(cpus[id], node_procs[i])) {
+                return -1;
+            }
+        }
+    }
+
+    for (int id = 1; id <= num_threads; id++) {
+        if (!process_admit_batch(cpus[id], node_procs + first[id], first[id + 1] - first[id])) {
+            return -1;
+        }
+    }
+    free(first);
+    free(node_procs);
+    free(cpus);
+
+    process_run(num_workers);
 
     /* Output the statistics for processes in order of completion.
      */
     process_summary(stdout);
+    if (trace != NULL) {
+        fclose(trace);
+    }
 
     return 0;
 }
\ No newline at end of file
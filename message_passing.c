@@ -2,4 +2,229 @@
 // Created by saher on 20/07/2023.
 //
 
+#include <stdlib.h>
 #include "message_passing.h"
+
+/* Create an empty mailbox
+ * @params:
+ *   None
+ * @returns:
+ *   pointer to the new mailbox
+ */
+mailbox *mailbox_new() {
+    /* Assume the allocation will be successful
+     */
+    mailbox *box = aligned_alloc(MAILBOX_CACHE_LINE, sizeof(mailbox));
+
+    /* Slot i is free for the sender that claims position i
+     */
+    atomic_init(&box->head, 0);
+    box->tail = 0;
+    for (unsigned long i = 0; i < MAILBOX_SLOTS; i++) {
+        atomic_init(&box->slots[i].seq, i);
+    }
+    atomic_init(&box->overflowed, 0);
+    pthread_mutex_init(&box->overflow_lock, NULL);
+    box->overflow = NULL;
+    box->overflow_len = 0;
+    box->overflow_max = 0;
+    return box;
+}
+
+/* Send a message to the mailbox's node, safe to call from any thread
+ * @params:
+ *   box: mailbox of the receiving node
+ *   msg: message to send, copied into the mailbox
+ * @returns:
+ *   none
+ */
+void send(mailbox *box, message *msg) {
+    unsigned long pos = atomic_load_explicit(&box->head, memory_order_relaxed);
+
+    for (;;) {
+        mailbox_slot *slot = &box->slots[pos % MAILBOX_SLOTS];
+        unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        long diff = (long)(seq - pos);
+
+        if (diff == 0) {
+            /* The slot is free for this position, claim it
+             */
+            if (atomic_compare_exchange_weak_explicit(&box->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                slot->msg = *msg;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return;
+            }
+        } else if (diff < 0) {
+            /* The ring is full, the receiver has not read this slot since the last lap
+             */
+            break;
+        } else {
+            /* Another sender claimed the position first
+             */
+            pos = atomic_load_explicit(&box->head, memory_order_relaxed);
+        }
+    }
+
+    /* Assume the reallocation will be successful
+     */
+    pthread_mutex_lock(&box->overflow_lock);
+    if (box->overflow_len == box->overflow_max) {
+        box->overflow_max = box->overflow_max ? box->overflow_max * 2 : MAILBOX_SLOTS;
+        box->overflow = realloc(box->overflow, box->overflow_max * sizeof(message));
+    }
+    box->overflow[box->overflow_len++] = *msg;
+    atomic_store(&box->overflowed, 1);
+    pthread_mutex_unlock(&box->overflow_lock);
+}
+
+/* Receive every message that has been sent to the mailbox's node, only the owning node may call this
+ * @params:
+ *   box : mailbox of the receiving node
+ *   into: list of messages the received ones are added to
+ * @returns:
+ *   number of messages received
+ */
+int recv(mailbox *box, ArrayList *into) {
+    int count = 0;
+
+    for (;;) {
+        mailbox_slot *slot = &box->slots[box->tail % MAILBOX_SLOTS];
+        unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != box->tail + 1) {
+            break;
+        }
+
+        alist_add(into, &slot->msg);
+        count++;
+
+        /* Hand the slot back to senders for the next lap
+         */
+        atomic_store_explicit(&slot->seq, box->tail + MAILBOX_SLOTS, memory_order_release);
+        box->tail++;
+    }
+
+    if (atomic_load(&box->overflowed)) {
+        pthread_mutex_lock(&box->overflow_lock);
+        for (int i = 0; i < box->overflow_len; i++) {
+            alist_add(into, &box->overflow[i]);
+        }
+        count += box->overflow_len;
+        box->overflow_len = 0;
+        atomic_store(&box->overflowed, 0);
+        pthread_mutex_unlock(&box->overflow_lock);
+    }
+
+    return count;
+}
+
+/* Free a mailbox
+ * @params:
+ *   box: mailbox to free
+ * @returns:
+ *   none
+ */
+void mailbox_destroy(mailbox *box) {
+    pthread_mutex_destroy(&box->overflow_lock);
+    free(box->overflow);
+    free(box);
+}
+
+/* Hash the addresses of a channel's processes to a slot of the table
+ * @params:
+ *   table   : channel table
+ *   sender  : address of the sending process
+ *   receiver: address of the receiving process
+ * @returns:
+ *   index of the slot to start probing from
+ */
+static int channel_hash(channel_table *table, unsigned long sender, unsigned long receiver) {
+    unsigned long key = (sender * 0x9E3779B97F4A7C15UL) ^ receiver;
+    key *= 0x9E3779B97F4A7C15UL;
+    return (int)(key >> 32) & (table->size - 1);
+}
+
+/* Create an empty channel table
+ * @params:
+ *   None
+ * @returns:
+ *   pointer to the new table
+ */
+channel_table *channels_new() {
+    /* Assume the allocations will be successful
+     */
+    channel_table *table = malloc(sizeof(channel_table));
+    table->size = 16;
+    table->used = 0;
+    table->slots = calloc(table->size, sizeof(channel));
+    return table;
+}
+
+/* Find the channel between two processes, adding it to the table if there is none
+ * @params:
+ *   table   : table of the receiving node
+ *   sender  : address of the sending process
+ *   receiver: address of the receiving process
+ * @returns:
+ *   pointer to the channel
+ */
+channel *channel_get(channel_table *table, unsigned long sender, unsigned long receiver) {
+    int i = channel_hash(table, sender, receiver);
+    while (table->slots[i].messages != NULL) {
+        if (table->slots[i].sender == sender && table->slots[i].receiver == receiver) {
+            return &table->slots[i];
+        }
+        i = (i + 1) & (table->size - 1);
+    }
+
+    /* Keep the table at most half full so probes stay short, channels are never removed
+     * Assume the allocation will be successful
+     */
+    if (2 * (table->used + 1) > table->size) {
+        channel *old = table->slots;
+        int old_size = table->size;
+
+        table->size *= 2;
+        table->slots = calloc(table->size, sizeof(channel));
+        for (int j = 0; j < old_size; j++) {
+            if (old[j].messages != NULL) {
+                int k = channel_hash(table, old[j].sender, old[j].receiver);
+                while (table->slots[k].messages != NULL) {
+                    k = (k + 1) & (table->size - 1);
+                }
+                table->slots[k] = old[j];
+            }
+        }
+        free(old);
+
+        i = channel_hash(table, sender, receiver);
+        while (table->slots[i].messages != NULL) {
+            i = (i + 1) & (table->size - 1);
+        }
+    }
+
+    channel *ch = &table->slots[i];
+    ch->sender = sender;
+    ch->receiver = receiver;
+    ch->waiter = NULL;
+    ch->received = 0;
+    ch->messages = alist_initialize(4, sizeof(message), "message");
+    table->used++;
+    return ch;
+}
+
+/* Free a channel table and the messages in its channels
+ * @params:
+ *   table: table to free
+ * @returns:
+ *   none
+ */
+void channels_destroy(channel_table *table) {
+    for (int i = 0; i < table->size; i++) {
+        if (table->slots[i].messages != NULL) {
+            alist_destroy(table->slots[i].messages);
+        }
+    }
+    free(table->slots);
+    free(table);
+}
@@ -4,9 +4,131 @@
 
 #ifndef PROSIM_MESSAGE_PASSING_H
 #define PROSIM_MESSAGE_PASSING_H
+#include <pthread.h>
+#include <stdatomic.h>
 #include "context.h"
+#include "Data Structures/ArrayList.h"
 
-void send(context* sender, context* receiver);
+/* Processes are addressed by their node and process id together
+ * Programs name a process as node * 100 + process id, so only processes 1 to MSG_NAMED_PROCS - 1 of a node can be named.
+ */
+#define MSG_NAMED_PROCS 100
+#define MSG_ADDRESS(node, proc) (((unsigned long)(unsigned)(node) << 32) | (unsigned)(proc))
+#define MSG_NODE(address) ((int)((address) >> 32))
+#define MSG_PROC(address) ((int)((address) & 0xFFFFFFFFUL))
+#define MSG_NAMED(name) MSG_ADDRESS((name) / MSG_NAMED_PROCS, (name) % MSG_NAMED_PROCS)
+
+#define MAILBOX_SLOTS 256        /* messages the ring of a mailbox holds before senders use the overflow list */
+#define MAILBOX_CACHE_LINE 64
+
+typedef struct message {
+    unsigned long sender;        /* address of the sending process */
+    unsigned long receiver;      /* address of the receiving process */
+    int time;                    /* tick the message was sent at */
+    int arrival;                 /* first tick at which the receiver can take it */
+    unsigned long id;            /* numbered by the sending node, pairs a message with its anti-message */
+    int anti;                    /* set on an anti-message, which cancels the message with the same sender node and id */
+    int consumed;                /* tick the receiver took the message at, -1 while it is pending */
+} message;
+
+typedef struct mailbox_slot {
+    _Atomic unsigned long seq;   /* tells whether the slot is free or holds a message for the current lap */
+    message msg;
+} mailbox_slot;
+
+/* Mailbox of a receiving node
+ * Any thread can send, only the owning node receives. Sends claim a slot of the ring with one atomic
+ * operation, and only fall back to the locked overflow list while the ring is full.
+ */
+typedef struct mailbox {
+    _Alignas(MAILBOX_CACHE_LINE) _Atomic unsigned long head;    /* next slot a sender claims */
+    _Alignas(MAILBOX_CACHE_LINE) unsigned long tail;            /* next slot the receiver reads */
+    _Alignas(MAILBOX_CACHE_LINE) mailbox_slot slots[MAILBOX_SLOTS];
+    _Alignas(MAILBOX_CACHE_LINE) _Atomic int overflowed;       /* set while the overflow list has messages */
+    pthread_mutex_t overflow_lock;
+    message *overflow;
+    int overflow_len;
+    int overflow_max;
+} mailbox;
+
+/* Messages from one process to another, in the order they were sent
+ */
+typedef struct channel {
+    unsigned long sender;        /* address of the sending process */
+    unsigned long receiver;      /* address of the receiving process */
+    context *waiter;             /* the receiving process if it is waiting in a RECV on this channel, NULL otherwise */
+    int received;                /* messages at the front of the list that have been received */
+    ArrayList *messages;         /* messages delivered on the channel, NULL for a free slot of the table */
+} channel;
+
+/* A node's channels, in an open addressing hash table keyed on the sending and receiving processes
+ */
+typedef struct channel_table {
+    channel *slots;
+    int size;                    /* number of slots, a power of 2 */
+    int used;                    /* number of channels */
+} channel_table;
+
+/* Create an empty mailbox
+ * @params:
+ *   None
+ * @returns:
+ *   pointer to the new mailbox
+ */
+mailbox *mailbox_new();
+
+/* Send a message to the mailbox's node, safe to call from any thread
+ * @params:
+ *   box: mailbox of the receiving node
+ *   msg: message to send, copied into the mailbox
+ * @returns:
+ *   none
+ */
+void send(mailbox *box, message *msg);
+
+/* Receive every message that has been sent to the mailbox's node, only the owning node may call this
+ * Messages from one sender are received in the order they were sent, unless the ring was full.
+ * @params:
+ *   box : mailbox of the receiving node
+ *   into: list of messages the received ones are added to
+ * @returns:
+ *   number of messages received
+ */
+int recv(mailbox *box, ArrayList *into);
+
+/* Free a mailbox
+ * @params:
+ *   box: mailbox to free
+ * @returns:
+ *   none
+ */
+void mailbox_destroy(mailbox *box);
+
+/* Create an empty channel table
+ * @params:
+ *   None
+ * @returns:
+ *   pointer to the new table
+ */
+channel_table *channels_new();
+
+/* Find the channel between two processes, adding it to the table if there is none
+ * The table may grow, which moves the channels, so the pointer is only good until the next call.
+ * @params:
+ *   table   : table of the receiving node
+ *   sender  : address of the sending process
+ *   receiver: address of the receiving process
+ * @returns:
+ *   pointer to the channel
+ */
+channel *channel_get(channel_table *table, unsigned long sender, unsigned long receiver);
+
+/* Free a channel table and the messages in its channels
+ * @params:
+ *   table: table to free
+ * @returns:
+ *   none
+ */
+void channels_destroy(channel_table *table);
 
-void recv(context* receiver, context* sender);
 #endif //PROSIM_MESSAGE_PASSING_H
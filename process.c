@@ -2,96 +2,515 @@
 // Created by Alex Brodsky on 2023-05-07.
 //
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <pthread.h>
 #include "process.h"
-#include "Utils/barrier.h"
+#include "Utils/workers.h"
+#include "Data Structures/ConcurrentMap.h"
 
-#define MAX_PROCS 100
-#define MAX_THREADS 100
+/* Ready queues keep priorities below this in O(1) FIFO buckets and switch to a heap otherwise.
+ */
+#define READY_PRIORITY_LEVELS 128
+
+/* In optimistic mode a node saves its state at most this many ticks apart
+ */
+#define CHECKPOINT_INTERVAL 16
+
+/* Saved state of a node, from the start of a tick, for rolling back to
+ */
+typedef struct checkpoint {
+    int clock_time;
+    context *cur;
+    int cpu_quantum;
+    int next_event;
+    int queue_seq;
+    int num_finished;        /* length of the finished log */
+    unsigned long msg_id;    /* id of the first message sent after the checkpoint */
+    long log_end;            /* position in the node's output where the tick starts */
+    char *procs;             /* copies of the node's process contexts, in the order of the node's process table */
+} checkpoint;
+
+/* A process waiting in a RECV that has been handed its message, to be woken up when it arrives
+ */
+typedef struct handoff {
+    int arrival;             /* tick the message arrives */
+    int queued;              /* when the process started waiting, to order equal arrivals */
+    context *proc;
+} handoff;
 
+/* Where a process lives, found in the process directory by its message address
+ */
+typedef struct directory_entry {
+    processor_t *cpu;
+    context *proc;
+} directory_entry;
+
+/* Process states, recorded as the codes of their events
+ */
 enum {
-    PROC_NEW = 0,
-    PROC_READY,
-    PROC_RUNNING,
-    PROC_BLOCKED,
-    PROC_FINISHED
+    PROC_NEW = EVENT_NEW,
+    PROC_READY = EVENT_READY,
+    PROC_RUNNING = EVENT_RUNNING,
+    PROC_BLOCKED = EVENT_BLOCKED,
+    PROC_RECEIVING = EVENT_RECEIVING,
+    PROC_FINISHED = EVENT_FINISHED
 };
 
-static char *states[] = {"new", "ready", "running", "blocked", "finished"};
+/* Whether to record an event of a level for a node and process
+ * Levels above PROSIM_TRACE_LEVEL are constant false, so the code recording them is compiled out.
+ */
+#define TRACING(level, node, pid) ((level) <= PROSIM_TRACE_LEVEL && trace_wanted(level, node, pid))
+
+/* Output is written out whenever the tick every node has settled moves on by this much
+ */
+#define TRACE_FLUSH_INTERVAL 64
+
+/* How much output is gathered before it is written
+ */
+#define TRACE_BUFFER_SIZE 65536
+
 static int quantum;
-static PriorityQueue *finished;
-extern barrier_t barrier;
+static sim_mode_t sim_mode;
+static int lookahead;
+static int optimism;
+static trace_level_t trace_level = TRACE_CLOCK;
+static int trace_node;
+static int trace_pid;
+static trace_writer *binary_trace;
+
+/* All nodes, so that their finished processes can be merged at the end
+ */
+static processor_t **nodes;
+static int num_nodes;
+static int max_nodes;
+static pthread_mutex_t nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* All processes by message address, filled in as they are registered and only read once the simulation runs
+ */
+static ConcurrentMap *directory;
 
 /* Initialize the simulation
  * @params:
  *   quantum: the CPU quantum to use in the situation
+ *   mode   : how process_run advances the clock
+ *   latency: minimum number of ticks a message takes between nodes, at least 1
+ *   ahead  : if positive, run optimistically with nodes going up to this many ticks past GVT between GVT rounds
  * @returns:
  *   returns 1
  */
-extern void process_init(int cpu_quantum) {
-    /* Set up the finish queue and store the quantum
-     * Assume the queue will be allocated
+extern void process_init(int cpu_quantum, sim_mode_t mode, int latency, int ahead) {
+    /* Store the quantum and the simulation mode
+     * No node can affect another sooner than a message can get there, which is how far nodes may run ahead
      */
     quantum = cpu_quantum;
-    finished = pq_init(sizeof(context));
+    sim_mode = mode;
+    lookahead = latency < 1 ? 1 : latency;
+    optimism = ahead > 0 ? ahead : 0;
+
+    /* Assume the allocation will be successful
+     */
+    directory = cm_init(64, sizeof(directory_entry));
+}
+
+/* Choose what the simulation outputs
+ * @params:
+ *   level: how much to output
+ *   node : if positive, only output what happens on this node
+ *   pid  : if positive, only output what happens to the processes with this id, along with their nodes' clock ticks
+ * @returns:
+ *   none
+ */
+extern void process_trace(trace_level_t level, int node, int pid) {
+    trace_level = level;
+    trace_node = node > 0 ? node : 0;
+    trace_pid = pid > 0 ? pid : 0;
+}
+
+/* Write the output to a binary trace instead of stdout
+ * @params:
+ *   fout    : file to write the trace to
+ *   compress: if true, compress the trace
+ * @returns:
+ *   none
+ */
+extern void process_binary_trace(FILE *fout, int compress) {
+    binary_trace = trace_writer_new(fout, compress);
 }
 
 /* Create a new node context
  * @params:
- *   None
+ *   node_id: id of the node
  * @returns:
  *   pointer to new node context.
  */
-extern processor_t * process_new() {
+extern processor_t * process_new(int node_id) {
     /* Allocate struct and set up the queues
      * Assume the queues will be allocated
      * Process ID sequence begins at 1
      */
     processor_t * cpu = calloc(1, sizeof(processor_t));
+#ifdef PROSIM_BLOCKED_HEAP
     cpu->blocked = pq_init(sizeof(context));
-    cpu->ready = pq_init(sizeof(context));
+#else
+    cpu->blocked = tw_init(-1);
+#endif
+    cpu->ready = pq_init_bounded(sizeof(context), READY_PRIORITY_LEVELS);
+    cpu->finished = alist_initialize(16, sizeof(context *), "context *");
+    cpu->procs = alist_initialize(16, sizeof(context *), "context *");
+    cpu->checkpoints = alist_initialize(4, sizeof(checkpoint), "checkpoint");
+    cpu->mailbox = mailbox_new();
+    cpu->inbox = alist_initialize(16, sizeof(message), "message");
+    cpu->channels = channels_new();
+    cpu->handed = alist_initialize(4, sizeof(handoff), "handoff");
+    cpu->sent = alist_initialize(16, sizeof(message), "message");
+    cpu->sent_min = INT_MAX;
     cpu->next_proc_id = 1;
+    cpu->node_id = node_id;
+
+    /* Register the node for process_run and process_summary, this happens once per node before the simulation starts
+     * Assume the reallocation will be successful
+     */
+    pthread_mutex_lock(&nodes_lock);
+    if (num_nodes == max_nodes) {
+        max_nodes = max_nodes ? max_nodes * 2 : 16;
+        nodes = realloc(nodes, max_nodes * sizeof(processor_t *));
+    }
+    nodes[num_nodes++] = cpu;
+    pthread_mutex_unlock(&nodes_lock);
+
     return cpu;
 }
 
-/* Admit a process into the simulation
+/* Check whether an event is output with the chosen level and filter
+ * @params:
+ *   level: level of the event
+ *   node : node id
+ *   pid  : process id, 0 for the node's own events
+ * @returns:
+ *   1 if the event is to be recorded, 0 otherwise
+ */
+static inline int trace_wanted(trace_level_t level, int node, int pid) {
+    return level <= trace_level && (trace_node == 0 || node == trace_node) &&
+           (trace_pid == 0 || pid == 0 || pid == trace_pid);
+}
+
+/* Record an event in a node's output log
+ * Nodes only ever write to their own log, which is written out in order of time once every node is past it.
+ * In optimistic mode the events after a checkpoint are taken back if the node is rolled back to it.
  * @params:
- *   proc: pointer to the program context of the process to be admitted
  *   cpu : node context
+ *   node: node id to report
+ *   pid : process id, 0 for the node's own events
+ *   code: process state or node event
+ *   arg : detail of the event
  * @returns:
- *   returns 1
+ *   none
  */
-static void print_process(processor_t *cpu, context *proc) {
-    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static void trace_add(processor_t *cpu, int node, int pid, int code, int arg) {
+    /* The checkpoint a rollback goes back to can be from before GVT, and simulating those ticks again
+     * repeats output that is already final
+     */
+    if (optimism && cpu->clock_time < cpu->committed) {
+        return;
+    }
 
-    /* Need to protect output with a global lock
-     * Assume this is the only place where output occurs during multithreaded execution
+    /* Assume the reallocation will be successful
      */
-    int result = pthread_mutex_lock(&lock);
-    printf("[%2.2d] %5.5d: process %d %s\n", proc->thread, cpu->clock_time,
-           proc->id, states[proc->state]);
-    result = pthread_mutex_unlock(&lock);
+    if (cpu->log_len == cpu->log_max) {
+        cpu->log_max = cpu->log_max ? 2 * cpu->log_max : 64;
+        cpu->log = realloc(cpu->log, cpu->log_max * sizeof(trace_event));
+    }
+    trace_event *event = &cpu->log[cpu->log_len++];
+    event->time = cpu->clock_time;
+    event->node = node;
+    event->pid = pid;
+    event->code = code;
+    event->arg = arg;
+}
+
+/* Print the state of a process
+ * @params:
+ *   proc: pointer to the program context of the process
+ *   cpu : node context
+ * @returns:
+ *   none
+ */
+static void print_process(processor_t *cpu, context *proc) {
+    if (TRACING(TRACE_STATE, proc->thread, proc->id)) {
+        trace_add(cpu, proc->thread, proc->id, proc->state, 0);
+    }
 }
 
-/* Add process to finished queue when they are done
+/* Add process to the node's finished log when they are done
+ * The log is in order of completion time, and by process id among processes finishing on the same tick,
+ * so only the owning node ever touches it.
  * @params:
  *   proc: pointer to the program context of the finished process
  *   cpu : node context
  * @returns:
- *   returns 1
+ *   none
  */
 static void process_finished(processor_t *cpu, context *proc) {
-    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    proc->finished = cpu->clock_time;
 
-    /* Need to protect shared queue global lock
-     * threads are ordered by time, thread id, proc id.
+    /* Processes finishing on the same tick are not necessarily done in id order
      */
-    proc->finished = cpu->clock_time;
-    int result = pthread_mutex_lock(&lock);
-    int order = cpu->clock_time * MAX_PROCS * MAX_THREADS + proc->thread * MAX_PROCS + proc->id;
-    pq_enqueue(finished, proc, order);
-    result = pthread_mutex_unlock(&lock);
+    int i = cpu->finished->currSize;
+    while (i > 0) {
+        context *prev = *(context **)alist_get(cpu->finished, i - 1);
+        if (prev->finished != proc->finished || prev->id < proc->id) {
+            break;
+        }
+        i--;
+    }
+    alist_add_at(cpu->finished, i, &proc);
+}
+
+/* Add a process to the blocked queue of the node
+ * @params:
+ *   cpu : node context
+ *   proc: process' context, with its wake-up time in the duration field
+ * @returns:
+ *   none
+ */
+static void blocked_insert(processor_t *cpu, context *proc) {
+#ifdef PROSIM_BLOCKED_HEAP
+    pq_enqueue(cpu->blocked, proc, proc->duration);
+#else
+    tw_insert(cpu->blocked, proc, proc->duration);
+#endif
+}
+
+/* Remove the next blocked process that is due to wake up at the current clock time
+ * Processes are returned in order of wake-up time, and in the order they blocked for equal times.
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   the process' context or NULL if no more processes are due
+ */
+static context *blocked_next_due(processor_t *cpu) {
+#ifdef PROSIM_BLOCKED_HEAP
+    PriorityNode *head = pq_peek(cpu->blocked);
+    if (head == NULL || ((context *)head->data)->duration > cpu->clock_time) {
+        return NULL;
+    }
+    return pq_dequeue(cpu->blocked);
+#else
+    /* Expiring the current tick is a no-op after the first call, so this is cheap to repeat
+     */
+    tw_advance(cpu->blocked, cpu->clock_time);
+    return tw_pop_expired(cpu->blocked);
+#endif
+}
+
+/* Find when the next blocked process wakes up
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   the earliest wake-up time, or -1 if no processes are blocked
+ */
+static int blocked_next_time(processor_t *cpu) {
+#ifdef PROSIM_BLOCKED_HEAP
+    PriorityNode *head = pq_peek(cpu->blocked);
+    return head == NULL ? -1 : ((context *)head->data)->duration;
+#else
+    return tw_next_time(cpu->blocked);
+#endif
+}
+
+/* Check whether any processes are blocked on the node
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   true if the blocked queue is empty
+ */
+static bool blocked_is_empty(processor_t *cpu) {
+#ifdef PROSIM_BLOCKED_HEAP
+    return pq_is_empty(cpu->blocked);
+#else
+    return tw_is_empty(cpu->blocked);
+#endif
+}
+
+/* Queue a process waiting in a RECV to be woken up when the first message on its channel arrives
+ * The queue is ordered by arrival, and by the order the processes started waiting for equal arrivals,
+ * so it does not matter when the message was delivered.
+ * @params:
+ *   cpu : node context
+ *   ch  : the channel the process is waiting on, with an unreceived message
+ * @returns:
+ *   none
+ */
+static void handoff_insert(processor_t *cpu, channel *ch) {
+    message *msg = alist_get(ch->messages, ch->received);
+    handoff h = {msg->arrival, ch->waiter->queued, ch->waiter};
+
+    int lo = 0;
+    int hi = cpu->handed->currSize;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        handoff *other = alist_get(cpu->handed, mid);
+        if (other->arrival < h.arrival || (other->arrival == h.arrival && other->queued < h.queued)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    alist_add_at(cpu->handed, lo, &h);
+}
+
+/* Take a process out of the hand-off queue, when the message it was handed is cancelled
+ * @params:
+ *   cpu : node context
+ *   proc: the waiting process
+ * @returns:
+ *   none
+ */
+static void handoff_remove(processor_t *cpu, context *proc) {
+    for (int i = 0; i < cpu->handed->currSize; i++) {
+        if (((handoff *)alist_get(cpu->handed, i))->proc == proc) {
+            alist_remove_into(cpu->handed, i, NULL);
+            return;
+        }
+    }
+}
+
+/* Find the channel a process in a RECV receives on
+ * @params:
+ *   cpu : node context
+ *   proc: process' context, with the address of the sending process as the argument of its RECV
+ * @returns:
+ *   pointer to the channel, good until the node's next channel lookup
+ */
+static channel *recv_channel(processor_t *cpu, context *proc) {
+    return channel_get(cpu->channels, MSG_NAMED(context_cur_duration(proc)), MSG_ADDRESS(cpu->node_id, proc->id));
+}
+
+/* Add a message to its channel on the node it was sent to
+ * If the receiving process is already waiting for it, the message is handed straight to the process.
+ * @params:
+ *   cpu : node context of the receiving node
+ *   msg : the message
+ * @returns:
+ *   none
+ */
+static void message_deliver(processor_t *cpu, message *msg) {
+    channel *ch = channel_get(cpu->channels, msg->sender, msg->receiver);
+    alist_add(ch->messages, msg);
+    if (ch->waiter != NULL && ch->messages->currSize == ch->received + 1) {
+        handoff_insert(cpu, ch);
+    }
+}
+
+/* Receive the first message of a channel
+ * In optimistic mode the message is kept, so a rollback can make it unreceived again.
+ * Otherwise received messages are dropped together once they make up half of the channel.
+ * @params:
+ *   cpu : node context
+ *   ch  : channel with an unreceived message
+ * @returns:
+ *   none
+ */
+static void message_take(processor_t *cpu, channel *ch) {
+    if (optimism) {
+        ((message *)alist_get(ch->messages, ch->received))->consumed = cpu->clock_time;
+        ch->received++;
+    } else {
+        ch->received++;
+        if (2 * ch->received >= ch->messages->currSize) {
+            alist_remove_range(ch->messages, 0, ch->received);
+            ch->received = 0;
+        }
+    }
+}
+
+/* Make a process wait in its RECV
+ * If the message is already on the way the process is handed it straight away, otherwise the
+ * SEND that matches the RECV does so when the message is delivered.
+ * @params:
+ *   cpu : node context
+ *   proc: process' context
+ * @returns:
+ *   none
+ */
+static void message_wait(processor_t *cpu, context *proc) {
+    channel *ch = recv_channel(cpu, proc);
+    ch->waiter = proc;
+    cpu->receiving++;
+    if (ch->received < ch->messages->currSize) {
+        handoff_insert(cpu, ch);
+    }
+}
+
+/* Send the message of the SEND a process is at
+ * The message can be received from the lookahead after the current tick on, which is what lets nodes run
+ * that far without hearing from each other.
+ * @params:
+ *   cpu : node context
+ *   proc: process' context, with the address of the receiving process as the argument of its SEND
+ * @returns:
+ *   none
+ */
+static void send_message(processor_t *cpu, context *proc) {
+    /* Ticks that are simulated again after a rollback to before GVT have already sent their messages
+     */
+    if (optimism && cpu->clock_time < cpu->committed) {
+        return;
+    }
+
+    int name = context_cur_duration(proc);
+    unsigned long receiver = MSG_NAMED(name);
+    directory_entry *entry = cm_get(directory, receiver);
+    if (entry == NULL) {
+        trace_add(cpu, cpu->node_id, proc->id, EVENT_UNKNOWN_RECEIVER, name);
+        return;
+    }
+
+    /* A RECV names its sender the same way, so no RECV could ever take a message from a process
+     * whose id is too big to be named
+     */
+    if (proc->id >= MSG_NAMED_PROCS) {
+        trace_add(cpu, cpu->node_id, proc->id, EVENT_UNNAMED_SENDER, name);
+        return;
+    }
+    processor_t *dest = entry->cpu;
+
+    message msg = {MSG_ADDRESS(cpu->node_id, proc->id), receiver, cpu->clock_time,
+                   cpu->clock_time + lookahead, cpu->next_msg_id++, 0, -1};
+    if (optimism) {
+        alist_add(cpu->sent, &msg);
+    }
+
+    /* Messages between processes on the same node are delivered right away, and wake up a waiting receiver directly
+     */
+    if (dest == cpu) {
+        message_deliver(cpu, &msg);
+        return;
+    }
+    send(dest->mailbox, &msg);
+    if (msg.arrival < cpu->sent_min) {
+        cpu->sent_min = msg.arrival;
+    }
+}
+
+/* Receive the message of the RECV a process is at, if it has arrived
+ * Messages from the same sender are received in the order they were sent.
+ * @params:
+ *   cpu : node context
+ *   proc: process' context, with the address of the sending process as the argument of its RECV
+ * @returns:
+ *   1 if the message was received, 0 otherwise
+ */
+static int receive_message(processor_t *cpu, context *proc) {
+    channel *ch = recv_channel(cpu, proc);
+    if (ch->received == ch->messages->currSize ||
+            ((message *)alist_get(ch->messages, ch->received))->arrival > cpu->clock_time) {
+        return 0;
+    }
+    message_take(cpu, ch);
+    return 1;
 }
 
 /* Compute priority of process, depending on whether SJF or priority based scheduling is used
@@ -109,164 +528,1170 @@ static int actual_priority(context *proc) {
     return proc->priority;
 }
 
-/* Insert process into appropriate queue based on the primitive it is performing
+/* Move process into the state of the primitive it is performing
+ * Blocked and finished processes are queued here, ready processes are left for the caller to queue.
+ * SENDs and RECVs whose message is there take no time, the process goes on to the next primitive.
  * @params:
  *   proc: process' context
  *   cpu : node context
  *   next_op: if true, current primitive is done, so move IP to next primitive.
  * @returns:
- *   none
+ *   1 if the process is ready and needs to be added to the ready queue, 0 otherwise
  */
-static void insert_in_queue(processor_t *cpu, context *proc, int next_op) {
-    /* If current primitive is done, move to next
-     */
-    if (next_op) {
-        context_next_op(proc);
-        proc->duration = context_cur_duration(proc);
-    }
+static int update_state(processor_t *cpu, context *proc, int next_op) {
+    int ready = 0;
+
+    int op;
+    for (;;) {
+        /* If current primitive is done, move to next
+         */
+        if (next_op) {
+            context_next_op(proc);
+            proc->duration = context_cur_duration(proc);
+        }
 
-    int op = context_cur_op(proc);
+        op = context_cur_op(proc);
+        if (op == OP_SEND) {
+            send_message(cpu, proc);
+        } else if (op != OP_RECV || !receive_message(cpu, proc)) {
+            break;
+        }
+        next_op = 1;
+    }
 
-    /* 3 cases:
+    /* 4 cases:
      * 1. If DOOP, process goes into ready queue
      * 2. If BLOCK, process goes into blocked queue
-     * 3. If HALT, process is not queued
+     * 3. If RECV, process waits for its message
+     * 4. If HALT, process is not queued
      */
     if (op == OP_DOOP) {
         proc->state = PROC_READY;
-        pq_enqueue(cpu->ready, proc, actual_priority(proc));
         proc->wait_count++;
         proc->enqueue_time = cpu->clock_time;
+        proc->queued = cpu->queue_seq++;
+        ready = 1;
     } else if (op == OP_BLOCK) {
         /* Use the duration field of the process to store their wake-up time.
          */
         proc->state = PROC_BLOCKED;
         proc->duration += cpu->clock_time;
-        pq_enqueue(cpu->blocked, proc, proc->duration);
+        proc->queued = cpu->queue_seq++;
+        blocked_insert(cpu, proc);
+    } else if (op == OP_RECV) {
+        /* The process is off the queues until the matching SEND hands it the message
+         */
+        proc->state = PROC_RECEIVING;
+        proc->queued = cpu->queue_seq++;
+        message_wait(cpu, proc);
     } else {
         proc->state = PROC_FINISHED;
         process_finished(cpu, proc);
     }
     print_process(cpu, proc);
+    return ready;
 }
 
-/* Admit a process into the simulation
+/* Insert process into appropriate queue based on the primitive it is performing
  * @params:
- *   proc: pointer to the program context of the process to be admitted
+ *   proc: process' context
  *   cpu : node context
+ *   next_op: if true, current primitive is done, so move IP to next primitive.
  * @returns:
- *   returns 1
+ *   none
  */
-extern int process_admit(processor_t *cpu, context *proc) {
-    /* Use node's PID counter to assign each process a unique process id.
-     */
-    proc->id = cpu->next_proc_id;
-    cpu->next_proc_id++;
-    proc->state = PROC_NEW;
-    print_process(cpu, proc);
-    insert_in_queue(cpu, proc, 1);
-    return 1;
+static void insert_in_queue(processor_t *cpu, context *proc, int next_op) {
+    if (update_state(cpu, proc, next_op)) {
+        pq_enqueue(cpu->ready, proc, actual_priority(proc));
+        if (TRACING(TRACE_QUEUE, proc->thread, proc->id)) {
+            trace_add(cpu, proc->thread, proc->id, EVENT_ENQUEUED, actual_priority(proc));
+        }
+    }
 }
 
-/* Perform the simulation
+/* Insert process into appropriate queue, holding back ready processes until batch_flush
+ * Processes reach the ready queue in the order they were batched, as with insert_in_queue.
  * @params:
+ *   proc: process' context
  *   cpu : node context
+ *   next_op: if true, current primitive is done, so move IP to next primitive.
  * @returns:
- *   returns 1
+ *   none
  */
-extern int process_simulate(processor_t *cpu, int thread_id) {
-    context *cur = NULL;
-    int cpu_quantum;
+static void insert_in_batch(processor_t *cpu, context *proc, int next_op) {
+    if (!update_state(cpu, proc, next_op)) {
+        return;
+    }
 
-    /* We can only stop when all processes are in the finished state
-     * no processes are readdy, running, or blocked
+    /* The batch arrays only grow, so steady state batching does not allocate
+     * Assume the reallocation will be successful
      */
-    while(!pq_is_empty(cpu->ready) || !pq_is_empty(cpu->blocked) || cur != NULL) {
-        int preempt = 0;
-
-        /* Step 1: Unblock processes
-         * If any of the unblocked processes have higher priority than current running process
-         *   we will need to preempt the current running process
-         */
-        while (!pq_is_empty(cpu->blocked)) {
-            /* We can stop ff process at head of queue should not be unblocked
-             */
-            context *proc = ((PriorityNode*)pq_peek(cpu->blocked))->data;
-            if (proc->duration > cpu->clock_time) {
-                break;
-            }
-
-            /* Move from blocked and reinsert into appropriate queue
-             */
-            pq_dequeue(cpu->blocked);
-            insert_in_queue(cpu, proc, 1);
-
-            /* preemption is necessary if a process is running, and it has lower priority than
-             * a newly unblocked ready process.
-             */
-            preempt |= cur != NULL && proc->state == PROC_READY &&
-                    actual_priority(cur) > actual_priority(proc);
-        }
-
-        /* Step 2: Update current running process
-         */
-        if (cur != NULL) {
-            cur->duration--;
-            cpu_quantum--;
-
-            /* Process stops running if it is preempted, has used up their quantum, or has completed its DOOP
-            */
-            if (cur->duration == 0 || cpu_quantum == 0 || preempt) {
-                insert_in_queue(cpu, cur, cur->duration == 0);
-                cur = NULL;
-            }
-        }
-
-        /* Step 3: Select next ready process to run if none are running
-         * Be sure to keep track of how long it waited in the ready queue
-         */
-        if (cur == NULL && !pq_is_empty(cpu->ready)) {
-            cur = ((PriorityNode*)pq_dequeue(cpu->ready))->data;
-            cur->wait_time += cpu->clock_time - cur->enqueue_time;
-            cpu_quantum = quantum;
-            cur->state = PROC_RUNNING;
-            print_process(cpu, cur);
-        }
-
-        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-        pthread_mutex_lock(&lock);
-        printf("Thread %d waiting...\n", thread_id);
-        pthread_mutex_unlock(&lock);
-        barrier_wait(&barrier);
-
-        pthread_mutex_lock(&lock);
-        printf("Thread %d, Clock = %2.2d\n", thread_id, cpu->clock_time);
-        pthread_mutex_unlock(&lock);
-        cpu->clock_time++;
+    if (cpu->batch_size == cpu->batch_max) {
+        cpu->batch_max = cpu->batch_max ? cpu->batch_max * 2 : 16;
+        cpu->batch = realloc(cpu->batch, cpu->batch_max * sizeof(context *));
+        cpu->batch_priority = realloc(cpu->batch_priority, cpu->batch_max * sizeof(int));
     }
+    cpu->batch[cpu->batch_size] = proc;
+    cpu->batch_priority[cpu->batch_size] = actual_priority(proc);
+    cpu->batch_size++;
+    if (TRACING(TRACE_QUEUE, proc->thread, proc->id)) {
+        trace_add(cpu, proc->thread, proc->id, EVENT_ENQUEUED, actual_priority(proc));
+    }
+}
 
-    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_lock(&lock);
-    printf("Thread %d complete\n", thread_id);
-    pthread_mutex_unlock(&lock);
+/* Add all batched ready processes to the ready queue
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   none
+ */
+static void batch_flush(processor_t *cpu) {
+    if (cpu->batch_size > 0) {
+        pq_enqueue_batch(cpu->ready, (void **)cpu->batch, cpu->batch_priority, cpu->batch_size, NULL);
+        cpu->batch_size = 0;
+    }
+}
 
-    barrier_done(&barrier);
-    /* next clock tick
+/* Give a process its id on the node
+ * @params:
+ *   proc: pointer to the program context of the process to be admitted
+ *   cpu : node context
+ * @returns:
+ *   1 if the process has its id, 0 if it could not be registered
+ */
+static int assign_id(processor_t *cpu, context *proc) {
+    /* Processes that were not registered ahead of their admission are registered now
      */
+    if (proc->id == 0 && !process_register(cpu, proc)) {
+        return 0;
+    }
+    alist_add(cpu->procs, &proc);
+    proc->state = PROC_NEW;
+    print_process(cpu, proc);
     return 1;
 }
 
-/* Output process summary post execution
+/* Register a process with a node before it is admitted
  * @params:
- *   fout : output file
+ *   cpu : node context
+ *   proc: pointer to the program context of the process
  * @returns:
- *   none
+ *   1 if the process is in the directory, 0 if its address is taken or the directory could not grow
  */
-extern void process_summary(FILE *fout) {
-    /* Finished processes are in order in the queue
+extern int process_register(processor_t *cpu, context *proc) {
+    /* Use node's PID counter to assign each process a unique process id,
+     * and list the process in the directory under the address other processes send to.
      */
-    while (!pq_is_empty(finished)) {
-        context *proc = ((PriorityNode*)pq_dequeue(finished))->data;
-        context_stats(proc, fout);
+    proc->id = cpu->next_proc_id;
+    cpu->next_proc_id++;
+
+    directory_entry entry = {cpu, proc};
+    if (!cm_put(directory, MSG_ADDRESS(cpu->node_id, proc->id), &entry)) {
+        fprintf(stderr, "Could not list process %d.%d in the process directory\n", cpu->node_id, proc->id);
+        return 0;
+    }
+    return 1;
+}
+
+/* Admit a process into the simulation
+ * @params:
+ *   proc: pointer to the program context of the process to be admitted
+ *   cpu : node context
+ * @returns:
+ *   1 if the process was admitted, 0 if it could not be registered
+ */
+extern int process_admit(processor_t *cpu, context *proc) {
+    if (!assign_id(cpu, proc)) {
+        return 0;
+    }
+    insert_in_queue(cpu, proc, 1);
+    return 1;
+}
+
+/* Admit a group of processes into the simulation
+ * @params:
+ *   cpu  : node context
+ *   procs: array of pointers to the program contexts of the processes to be admitted
+ *   num_procs: number of processes in the array
+ * @returns:
+ *   1 if all of them were admitted, 0 if one could not be registered, the ones before it are admitted
+ */
+extern int process_admit_batch(processor_t *cpu, context **procs, int num_procs) {
+    int admitted = 1;
+    for (int i = 0; i < num_procs; i++) {
+        if (!assign_id(cpu, procs[i])) {
+            admitted = 0;
+            break;
+        }
+        insert_in_batch(cpu, procs[i], 1);
+    }
+    batch_flush(cpu);
+    return admitted;
+}
+
+/* Check whether a node has processes left to simulate
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   1 if any process is ready, running, blocked, or waiting for a message, 0 if all are finished
+ */
+static int has_work(processor_t *cpu) {
+    return !pq_is_empty(cpu->ready) || !blocked_is_empty(cpu) || cpu->cur != NULL || cpu->receiving > 0;
+}
+
+/* Check whether every process left on a node is waiting in a RECV with no message on the way to it
+ * Such a node does nothing until a message is sent to it, and if no node has anything else to do and
+ * no message is on its way, the processes are deadlocked.
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   1 if the node is quiet, 0 otherwise
+ */
+static int node_quiet(processor_t *cpu) {
+    return cpu->receiving > 0 && cpu->cur == NULL && pq_is_empty(cpu->ready) && blocked_is_empty(cpu) &&
+           cpu->handed->currSize == 0;
+}
+
+/* Find the next tick on which something can happen on the node
+ * Until then no process wakes up, the running process neither completes its DOOP nor uses up
+ * its quantum, and no process is picked to run.
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   the tick of the next event, or INT_MAX if the node has no processes left to simulate
+ */
+static int next_event(processor_t *cpu) {
+    context *cur = cpu->cur;
+
+    /* The next event is the earliest of a wake-up, a message arriving for a waiting process, and the running
+     * process stopping. With nothing running the ready queue is empty, since step 3 would have picked a process.
+     * Messages that have not been delivered yet are accounted for by their senders.
+     */
+    int next = blocked_next_time(cpu);
+    if (next < 0) {
+        next = INT_MAX;
+    }
+    if (cpu->handed->currSize > 0 && ((handoff *)alist_get(cpu->handed, 0))->arrival < next) {
+        next = ((handoff *)alist_get(cpu->handed, 0))->arrival;
+    }
+    if (cur != NULL) {
+        int stop = cpu->clock_time + (cur->duration < cpu->cpu_quantum ? cur->duration : cpu->cpu_quantum);
+        if (stop < next) {
+            next = stop;
+        }
+    }
+    return next <= cpu->clock_time ? cpu->clock_time + 1 : next;
+}
+
+/* Finish the node's current clock tick, now that every node is done with it, and move to the next tick
+ * In SIM_EVENT mode the nodes jump together to the earliest next event of any node,
+ * with the skipped ticks reported as though they had been simulated one at a time.
+ * @params:
+ *   cpu : node context
+ *   global: the earliest next event of all nodes
+ * @returns:
+ *   none
+ */
+static void end_tick(processor_t *cpu, int global) {
+    /* A node with nothing left only reports the current tick
+     */
+    int until = has_work(cpu) ? global : cpu->clock_time + 1;
+    int skip = until - cpu->clock_time - 1;
+
+    if (TRACING(TRACE_CLOCK, cpu->node_id, 0)) {
+        trace_add(cpu, cpu->node_id, 0, EVENT_CLOCK, 0);
+        for (cpu->clock_time++; cpu->clock_time < until; cpu->clock_time++) {
+            trace_add(cpu, cpu->node_id, 0, EVENT_WAITING, 0);
+            trace_add(cpu, cpu->node_id, 0, EVENT_CLOCK, 0);
+        }
+    } else {
+        cpu->clock_time = skip > 0 ? until : cpu->clock_time + 1;
+    }
+
+    /* The running process keeps running through the skipped ticks
+     */
+    if (cpu->cur != NULL) {
+        cpu->cur->duration -= skip;
+        cpu->cpu_quantum -= skip;
+    }
+}
+
+/* Run the scheduler for the node's current tick
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   none
+ */
+static void run_tick(processor_t *cpu) {
+    int preempt = 0;
+    context *cur = cpu->cur;
+
+    /* Step 1: Unblock processes
+     * If any of the unblocked processes have higher priority than current running process
+     *   we will need to preempt the current running process
+     */
+    context *proc;
+    while ((proc = blocked_next_due(cpu)) != NULL) {
+        /* Move from blocked and reinsert into appropriate queue
+         * Ready processes are batched so a wake-up storm is added to the ready queue at once
+         */
+        insert_in_batch(cpu, proc, 1);
+
+        /* preemption is necessary if a process is running, and it has lower priority than
+         * a newly unblocked ready process.
+         */
+        preempt |= cur != NULL && proc->state == PROC_READY &&
+                actual_priority(cur) > actual_priority(proc);
+    }
+
+    /* Processes waiting in a RECV whose message has arrived are woken up the same way
+     */
+    while (cpu->handed->currSize > 0 && ((handoff *)alist_get(cpu->handed, 0))->arrival <= cpu->clock_time) {
+        handoff h;
+        alist_remove_into(cpu->handed, 0, &h);
+        proc = h.proc;
+
+        channel *ch = recv_channel(cpu, proc);
+        message_take(cpu, ch);
+        ch->waiter = NULL;
+        cpu->receiving--;
+        insert_in_batch(cpu, proc, 1);
+        preempt |= cur != NULL && proc->state == PROC_READY &&
+                actual_priority(cur) > actual_priority(proc);
+    }
+    batch_flush(cpu);
+
+    /* Step 2: Update current running process
+     */
+    if (cur != NULL) {
+        cur->duration--;
+        cpu->cpu_quantum--;
+
+        /* Process stops running if it is preempted, has used up their quantum, or has completed its DOOP
+        */
+        if (cur->duration == 0 || cpu->cpu_quantum == 0 || preempt) {
+            insert_in_queue(cpu, cur, cur->duration == 0);
+            cur = NULL;
+        }
+    }
+
+    /* Step 3: Select next ready process to run if none are running
+     * Be sure to keep track of how long it waited in the ready queue
+     */
+    if (cur == NULL && !pq_is_empty(cpu->ready)) {
+        cur = pq_dequeue(cpu->ready);
+        cur->wait_time += cpu->clock_time - cur->enqueue_time;
+        if (TRACING(TRACE_QUEUE, cur->thread, cur->id)) {
+            trace_add(cpu, cur->thread, cur->id, EVENT_DEQUEUED, cpu->clock_time - cur->enqueue_time);
+        }
+        cpu->cpu_quantum = quantum;
+        cur->state = PROC_RUNNING;
+        print_process(cpu, cur);
+    }
+    cpu->cur = cur;
+
+    if (TRACING(TRACE_CLOCK, cpu->node_id, 0)) {
+        trace_add(cpu, cpu->node_id, 0, EVENT_WAITING, 0);
+    }
+
+    cpu->next_event = sim_mode == SIM_EVENT ? next_event(cpu) : cpu->clock_time + 1;
+}
+
+/* Output that a node is complete
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   none
+ */
+static void print_complete(processor_t *cpu) {
+    if (TRACING(TRACE_CLOCK, cpu->node_id, 0)) {
+        trace_add(cpu, cpu->node_id, 0, EVENT_COMPLETE, 0);
+    }
+}
+
+/* Save the state of a node at the start of its current tick
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   none
+ */
+static void checkpoint_save(processor_t *cpu) {
+    checkpoint cp;
+    cp.clock_time = cpu->clock_time;
+    cp.cur = cpu->cur;
+    cp.cpu_quantum = cpu->cpu_quantum;
+    cp.next_event = cpu->next_event;
+    cp.queue_seq = cpu->queue_seq;
+    cp.num_finished = cpu->finished->currSize;
+    cp.msg_id = cpu->next_msg_id;
+    cp.log_end = cpu->log_start + cpu->log_len;
+
+    /* The queues are not saved, they are rebuilt from the process states on a rollback
+     * Assume the allocation will be successful
+     */
+    size_t size = 0;
+    for (int i = 0; i < cpu->procs->currSize; i++) {
+        size += context_size(*(context **)alist_get(cpu->procs, i));
+    }
+    cp.procs = malloc(size);
+
+    size = 0;
+    for (int i = 0; i < cpu->procs->currSize; i++) {
+        context *proc = *(context **)alist_get(cpu->procs, i);
+        memcpy(cp.procs + size, proc, context_size(proc));
+        size += context_size(proc);
+    }
+    alist_add(cpu->checkpoints, &cp);
+}
+
+/* Discard a node's oldest checkpoint
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   none
+ */
+static void checkpoint_drop_first(processor_t *cpu) {
+    checkpoint cp;
+    alist_remove_into(cpu->checkpoints, 0, &cp);
+    free(cp.procs);
+}
+
+/* Order processes by when they were queued
+ * @params:
+ *   a, b: pointers to process contexts
+ * @returns:
+ *   negative, zero, or positive as for qsort
+ */
+static int queued_order(const void *a, const void *b) {
+    return (*(context **)a)->queued - (*(context **)b)->queued;
+}
+
+/* Remove a message from its channel
+ * If the message has been received, the node is rolled back to before it was, and if it was handed
+ * to a waiting process, the process is handed the next message on the channel instead.
+ * @params:
+ *   cpu : node context
+ *   anti: the message, or an anti-message for it
+ * @returns:
+ *   none
+ */
+static void message_cancel(processor_t *cpu, message *anti) {
+    channel *ch = channel_get(cpu->channels, anti->sender, anti->receiver);
+    for (int i = 0; i < ch->messages->currSize; i++) {
+        message *msg = alist_get(ch->messages, i);
+        if (msg->id != anti->id) {
+            continue;
+        }
+
+        if (i < ch->received) {
+            process_rollback(cpu, msg->consumed);
+        }
+        int handed = ch->waiter != NULL && i == ch->received;
+        if (handed) {
+            handoff_remove(cpu, ch->waiter);
+        }
+        alist_remove_into(ch->messages, i, NULL);
+        if (handed && ch->received < ch->messages->currSize) {
+            handoff_insert(cpu, ch);
+        }
+        return;
+    }
+}
+
+/* Roll a node back to the state it had at an earlier tick
+ * Restores the latest checkpoint at or before the tick, and takes back the output and finished
+ * processes of the ticks after it. The node then simulates forward again from there.
+ * @params:
+ *   cpu : node context
+ *   time: the tick that has to be simulated again
+ * @returns:
+ *   1 if the node was rolled back, 0 if it has no state that old
+ */
+extern int process_rollback(processor_t *cpu, int time) {
+    int i = cpu->checkpoints->currSize - 1;
+    while (i >= 0 && ((checkpoint *)alist_get(cpu->checkpoints, i))->clock_time > time) {
+        i--;
+    }
+    if (i < 0) {
+        return 0;
+    }
+
+    /* Anything saved after the checkpoint is in the future of the restored state
+     */
+    for (int j = i + 1; j < cpu->checkpoints->currSize; j++) {
+        free(((checkpoint *)alist_get(cpu->checkpoints, j))->procs);
+    }
+    alist_truncate(cpu->checkpoints, i + 1);
+    checkpoint *cp = alist_get(cpu->checkpoints, i);
+
+    size_t size = 0;
+    for (int j = 0; j < cpu->procs->currSize; j++) {
+        context *proc = *(context **)alist_get(cpu->procs, j);
+        memcpy(proc, cp->procs + size, context_size(proc));
+        size += context_size(proc);
+    }
+    cpu->clock_time = cp->clock_time;
+    cpu->cur = cp->cur;
+    cpu->cpu_quantum = cp->cpu_quantum;
+    cpu->next_event = cp->next_event;
+    cpu->queue_seq = cp->queue_seq;
+    cpu->done = 0;
+    cpu->quiet = 0;
+    alist_truncate(cpu->finished, cp->num_finished);
+
+    /* Rebuild the queues, queuing the processes again in their original order keeps ties in the same order
+     * Assume the allocations will be successful
+     */
+    pq_destroy(cpu->ready);
+    cpu->ready = pq_init_bounded(sizeof(context), READY_PRIORITY_LEVELS);
+#ifdef PROSIM_BLOCKED_HEAP
+    pq_destroy(cpu->blocked);
+    cpu->blocked = pq_init(sizeof(context));
+#else
+    tw_destroy(cpu->blocked);
+    cpu->blocked = tw_init(-1);
+#endif
+
+    /* Messages received after the checkpoint are unreceived again, the processes waiting in RECVs are
+     * matched with them again as they are queued
+     */
+    alist_clear(cpu->handed);
+    cpu->receiving = 0;
+    for (int j = 0; j < cpu->channels->size; j++) {
+        channel *ch = &cpu->channels->slots[j];
+        if (ch->messages == NULL) {
+            continue;
+        }
+        ch->waiter = NULL;
+        while (ch->received > 0 &&
+                ((message *)alist_get(ch->messages, ch->received - 1))->consumed >= cp->clock_time) {
+            ch->received--;
+            ((message *)alist_get(ch->messages, ch->received))->consumed = -1;
+        }
+    }
+
+    context **queued = malloc((cpu->procs->currSize + 1) * sizeof(context *));
+    int num_queued = 0;
+    for (int j = 0; j < cpu->procs->currSize; j++) {
+        context *proc = *(context **)alist_get(cpu->procs, j);
+        if ((proc->state == PROC_READY || proc->state == PROC_BLOCKED || proc->state == PROC_RECEIVING) &&
+                proc != cpu->cur) {
+            queued[num_queued++] = proc;
+        }
+    }
+    qsort(queued, num_queued, sizeof(context *), queued_order);
+    for (int j = 0; j < num_queued; j++) {
+        if (queued[j]->state == PROC_READY) {
+            pq_enqueue(cpu->ready, queued[j], actual_priority(queued[j]));
+        } else if (queued[j]->state == PROC_RECEIVING) {
+            message_wait(cpu, queued[j]);
+        } else {
+            blocked_insert(cpu, queued[j]);
+        }
+    }
+    free(queued);
+
+    /* Messages sent after the checkpoint are cancelled with anti-messages, the node sends them again
+     * as it simulates forward
+     */
+    while (cpu->sent->currSize > 0) {
+        message *msg = alist_get(cpu->sent, cpu->sent->currSize - 1);
+        if (msg->id < cp->msg_id) {
+            break;
+        }
+        processor_t *dest = ((directory_entry *)cm_get(directory, msg->receiver))->cpu;
+        if (dest == cpu) {
+            message_cancel(cpu, msg);
+        } else {
+            msg->anti = 1;
+            send(dest->mailbox, msg);
+            if (msg->arrival < cpu->sent_min) {
+                cpu->sent_min = msg->arrival;
+            }
+        }
+        alist_truncate(cpu->sent, cpu->sent->currSize - 1);
+    }
+
+    /* Take back the output of the ticks being undone, except what is from before GVT
+     * since those ticks do not output it again
+     */
+    long keep = cp->log_end - cpu->log_start;
+    while (cpu->log_len > keep && cpu->log[cpu->log_len - 1].time >= cpu->committed) {
+        cpu->log_len--;
+    }
+    return 1;
+}
+
+/* Remove the messages a node no longer needs from a list, keeping the others in order
+ * @params:
+ *   list    : list of messages
+ *   before  : messages sent before this tick are removed, or received before it if received is set
+ *   received: if true, the list holds messages sent to the node, and only received ones are removed
+ * @returns:
+ *   number of messages removed
+ */
+static int messages_drop(ArrayList *list, int before, int received) {
+    int kept = 0;
+    for (int i = 0; i < list->currSize; i++) {
+        message *msg = alist_get(list, i);
+        int time = received ? msg->consumed : msg->time;
+        if (time >= 0 && time < before) {
+            continue;
+        }
+        if (kept != i) {
+            memcpy(alist_get(list, kept), msg, sizeof(message));
+        }
+        kept++;
+    }
+    int dropped = list->currSize - kept;
+    alist_truncate(list, kept);
+    return dropped;
+}
+
+/* Order messages by sending node and id, with an anti-message right after the message it cancels
+ * @params:
+ *   a, b: pointers to messages
+ * @returns:
+ *   negative, zero, or positive as for qsort
+ */
+static int message_order(const void *a, const void *b) {
+    const message *x = a;
+    const message *y = b;
+    if (MSG_NODE(x->sender) != MSG_NODE(y->sender)) {
+        return MSG_NODE(x->sender) - MSG_NODE(y->sender);
+    }
+    if (x->id != y->id) {
+        return x->id < y->id ? -1 : 1;
+    }
+    return x->anti - y->anti;
+}
+
+/* Deliver the messages in a node's mailbox to the node
+ * In optimistic mode a message that should have been received on a tick the node has already simulated
+ * rolls the node back to that tick, and an anti-message rolls it back to when the message it cancels was received.
+ * @params:
+ *   cpu : node context
+ * @returns:
+ *   none
+ */
+static void deliver_messages(processor_t *cpu) {
+    if (recv(cpu->mailbox, cpu->inbox) == 0) {
+        return;
+    }
+
+    /* The mailbox's overflow list can put a message behind later ones from the same node, sorting restores
+     * the order they were sent in, so channels stay in order and anti-messages come after their message
+     */
+    alist_sort(cpu->inbox, message_order);
+    for (int i = 0; i < cpu->inbox->currSize; i++) {
+        message *msg = alist_get(cpu->inbox, i);
+        if (msg->anti) {
+            message_cancel(cpu, msg);
+            continue;
+        }
+        if (optimism && (msg->arrival < cpu->clock_time || (cpu->quiet && msg->arrival == cpu->clock_time))) {
+            process_rollback(cpu, msg->arrival);
+        }
+        message_deliver(cpu, msg);
+    }
+    alist_clear(cpu->inbox);
+}
+
+/* Commit the part of a node's optimistic run that can no longer be rolled back
+ * Output from before GVT becomes final, and all checkpoints but the one needed to get back to GVT are freed.
+ * @params:
+ *   cpu : node context
+ *   gvt : global virtual time, no node will ever roll back to before it
+ * @returns:
+ *   none
+ */
+static void fossil_collect(processor_t *cpu, int gvt) {
+    /* A quiet node reports no local virtual time, but the ticks it has not simulated yet still have to be output
+     */
+    int commit = cpu->quiet && cpu->clock_time < gvt ? cpu->clock_time : gvt;
+    if (commit > cpu->committed) {
+        cpu->committed = commit;
+        cpu->settled = commit;
+    }
+
+    while (cpu->checkpoints->currSize > 1 &&
+            ((checkpoint *)alist_get(cpu->checkpoints, 1))->clock_time <= gvt) {
+        checkpoint_drop_first(cpu);
+    }
+
+    /* Messages sent before GVT can no longer be cancelled, and received messages are only needed
+     * to simulate forward again from the oldest checkpoint
+     */
+    messages_drop(cpu->sent, gvt, 0);
+    if (cpu->checkpoints->currSize > 0) {
+        int before = ((checkpoint *)alist_get(cpu->checkpoints, 0))->clock_time;
+        for (int i = 0; i < cpu->channels->size; i++) {
+            channel *ch = &cpu->channels->slots[i];
+            if (ch->messages != NULL && ch->received > 0) {
+                ch->received -= messages_drop(ch->messages, before, 1);
+            }
+        }
+    }
+}
+
+/* Simulate a node optimistically, as far ahead as the optimism allows
+ * The node saves its state as it goes, so it can be rolled back if it turns out to have run too far.
+ * @params:
+ *   cpu : node context
+ *   gvt : global virtual time, as of the end of the previous round
+ *   next: set to the node's local virtual time, the first tick it has not simulated yet
+ * @returns:
+ *   1 if the node needs to run again, 0 once it is finished and all of its run is committed
+ */
+static int optimistic_tick(processor_t *cpu, int gvt, int *next) {
+    int window_end = cpu->clock_time + optimism;
+    if (cpu->started) {
+        fossil_collect(cpu, gvt);
+        deliver_messages(cpu);
+        if (cpu->done && cpu->clock_time < gvt) {
+            cpu->settled = INT_MAX;
+            return 0;
+        }
+
+        /* With every node finished or quiet and no messages on their way, the processes left are waiting
+         * in RECVs that will never be matched
+         */
+        if (gvt >= INT_MAX - 1 && cpu->quiet && node_quiet(cpu)) {
+            cpu->deadlocked = 1;
+            cpu->settled = cpu->clock_time;
+            return 0;
+        }
+
+        /* The window is measured from GVT rather than the node's clock, so a node that has been rolled back
+         * far still gets past GVT, and the simulation makes progress in every round
+         */
+        window_end = gvt < INT_MAX - optimism ? gvt + optimism : INT_MAX;
+    }
+    cpu->started = 1;
+
+    while (!cpu->done && cpu->clock_time < window_end) {
+        deliver_messages(cpu);
+
+        /* A quiet node stays at the tick it stopped at until a message is handed to one of its processes
+         */
+        if (cpu->quiet) {
+            if (node_quiet(cpu)) {
+                break;
+            }
+            cpu->quiet = 0;
+            cpu->next_event = sim_mode == SIM_EVENT ? next_event(cpu) : cpu->clock_time + 1;
+            end_tick(cpu, cpu->next_event < window_end ? cpu->next_event : window_end);
+            continue;
+        }
+        if (!has_work(cpu)) {
+            print_complete(cpu);
+            cpu->done = 1;
+            break;
+        }
+
+        int last = cpu->checkpoints->currSize - 1;
+        if (last < 0 || cpu->clock_time >=
+                ((checkpoint *)alist_get(cpu->checkpoints, last))->clock_time + CHECKPOINT_INTERVAL) {
+            checkpoint_save(cpu);
+        }
+
+        run_tick(cpu);
+        if (node_quiet(cpu)) {
+            cpu->quiet = 1;
+            break;
+        }
+
+        /* Skip no further than the window, a message from another node that arrives in the skipped ticks
+         * rolls the node back
+         */
+        end_tick(cpu, cpu->next_event < window_end ? cpu->next_event : window_end);
+    }
+
+    /* Messages still on their way count towards GVT as well, a quiet node only counts through them
+     */
+    *next = cpu->done || (cpu->quiet && node_quiet(cpu)) ? INT_MAX : cpu->clock_time;
+    if (cpu->sent_min < *next) {
+        *next = cpu->sent_min;
+    }
+    cpu->sent_min = INT_MAX;
+    if (TRACING(TRACE_BARRIER, cpu->node_id, 0)) {
+        trace_add(cpu, cpu->node_id, 0, EVENT_BARRIER, *next);
+    }
+    return 1;
+}
+
+/* Simulate a window of clock ticks of a node
+ * Finishes the previous window, then runs the node up to the lookahead without waiting for the other nodes,
+ * since nothing they do in that time can reach this node before the window is over. Every node must finish
+ * a window before any node starts the next one.
+ * @params:
+ *   cpu : node context
+ *   global: the earliest next event reported by any node for the previous window
+ *   next: set to the node's next event after the window
+ * @returns:
+ *   1 if the node needs to run again, 0 once all its processes are finished
+ */
+extern int process_tick(processor_t *cpu, int global, int *next) {
+    if (optimism) {
+        return optimistic_tick(cpu, global, next);
+    }
+
+    if (cpu->started) {
+        if (cpu->done) {
+            return 0;
+        }
+
+        /* With every node finished or quiet and no messages on their way, the processes left are waiting
+         * in RECVs that will never be matched
+         */
+        if (global >= INT_MAX - 1 && has_work(cpu)) {
+            cpu->deadlocked = 1;
+            cpu->settled = cpu->clock_time;
+            return 0;
+        }
+
+        /* A quiet node stays at the tick it stopped at until a message is handed to one of its processes,
+         * then reports the ticks in between as it catches up with the other nodes
+         */
+        if (cpu->quiet) {
+            deliver_messages(cpu);
+            if (node_quiet(cpu)) {
+                *next = INT_MAX;
+                return 1;
+            }
+            cpu->quiet = 0;
+        }
+        end_tick(cpu, global);
+    }
+    cpu->started = 1;
+
+    int window_end = cpu->clock_time + lookahead;
+    int next_at;
+    for (;;) {
+        deliver_messages(cpu);
+
+        /* We can only stop when all processes are in the finished state
+         * no processes are readdy, running, or blocked
+         */
+        if (!has_work(cpu)) {
+            print_complete(cpu);
+            cpu->settled = INT_MAX;
+
+            /* Messages sent in the window still have to be accounted for, so the node stays for one more round
+             */
+            if (cpu->sent_min == INT_MAX) {
+                return 0;
+            }
+            cpu->done = 1;
+            *next = cpu->sent_min;
+            cpu->sent_min = INT_MAX;
+            return 1;
+        }
+
+        /* A quiet node has no next event of its own in either mode, only a message sent to it can wake it up
+         */
+        run_tick(cpu);
+        cpu->quiet = node_quiet(cpu);
+        next_at = cpu->quiet ? INT_MAX : cpu->next_event;
+        if (next_at >= window_end) {
+            break;
+        }
+        end_tick(cpu, next_at);
+    }
+
+    /* Finishing the tick the node stopped at can still add to its output
+     */
+    cpu->settled = cpu->clock_time;
+
+    /* Messages sent in the window may arrive before any event of the nodes they go to
+     */
+    *next = next_at < cpu->sent_min ? next_at : cpu->sent_min;
+    cpu->sent_min = INT_MAX;
+    if (TRACING(TRACE_BARRIER, cpu->node_id, 0)) {
+        trace_add(cpu, cpu->node_id, 0, EVENT_BARRIER, *next);
+    }
+    return 1;
+}
+
+/* Run one tick of a node as a worker task
+ * @params:
+ *   task: node context
+ *   global: the earliest next event reported by any node for the previous tick
+ *   value: set to the node's next event
+ * @returns:
+ *   1 if the node needs to run again, 0 once all its processes are finished
+ */
+static int node_task(void *task, int global, int *value) {
+    return process_tick(task, global, value);
+}
+
+/* Order nodes by id
+ * @params:
+ *   a, b: pointers to node contexts
+ * @returns:
+ *   negative, zero, or positive as a's id is below, equal to, or above b's
+ */
+static int node_order(const void *a, const void *b) {
+    processor_t *x = *(processor_t **)a;
+    processor_t *y = *(processor_t **)b;
+    return (x->node_id > y->node_id) - (x->node_id < y->node_id);
+}
+
+/* Write out the nodes' output from before a tick and remove it from their logs
+ * Events are written in order of time, then node id, and a node's events for the same tick stay in the order
+ * it recorded them. Only called while no node is running, so the logs can be read without locking. The output
+ * is the same however the simulation was split into phases and whenever it is written out.
+ * @params:
+ *   until: events from this tick on are kept
+ * @returns:
+ *   none
+ */
+static void trace_flush(int until) {
+    /* Every node that is not finished records events on every tick, so rather than merging the logs through
+     * a heap, each pass writes out the earliest tick of all the nodes that have anything left before until.
+     * Assume the allocations will be successful
+     */
+    processor_t **active = calloc(num_nodes + 1, sizeof(processor_t *));
+    int *next = calloc(num_nodes + 1, sizeof(int));
+    char *buffer = malloc(TRACE_BUFFER_SIZE);
+    char *end = buffer;
+    int size = 0;
+
+    for (int i = 0; i < num_nodes; i++) {
+        if (nodes[i]->log_len > 0 && nodes[i]->log[0].time < until) {
+            active[size++] = nodes[i];
+        }
+    }
+    qsort(active, size, sizeof(processor_t *), node_order);
+
+    while (size > 0) {
+        int time = INT_MAX;
+        for (int i = 0; i < size; i++) {
+            if (active[i]->log[next[i]].time < time) {
+                time = active[i]->log[next[i]].time;
+            }
+        }
+
+        /* Nodes that have nothing left before until are dropped, keeping the others in order
+         */
+        int kept = 0;
+        for (int i = 0; i < size; i++) {
+            processor_t *cpu = active[i];
+            int pos = next[i];
+            while (pos < cpu->log_len && cpu->log[pos].time == time) {
+                if (binary_trace != NULL) {
+                    trace_write(binary_trace, &cpu->log[pos++]);
+                    continue;
+                }
+                if (end - buffer > TRACE_BUFFER_SIZE - TRACE_LINE_MAX) {
+                    fwrite(buffer, 1, end - buffer, stdout);
+                    end = buffer;
+                }
+                end = trace_format(&cpu->log[pos++], end);
+            }
+            if (pos < cpu->log_len && cpu->log[pos].time < until) {
+                active[kept] = cpu;
+                next[kept++] = pos;
+            } else {
+                memmove(cpu->log, cpu->log + pos, (cpu->log_len - pos) * sizeof(trace_event));
+                cpu->log_len -= pos;
+                cpu->log_start += pos;
+            }
+        }
+        size = kept;
+    }
+    fwrite(buffer, 1, end - buffer, stdout);
+    free(buffer);
+    free(active);
+    free(next);
+}
+
+/* Report the nodes whose processes wait in RECVs that will never be matched
+ * The deadlock is found on the first tick no node simulated. A deadlocked node stopped at the tick it went
+ * quiet on, while other nodes may still have been finishing in the round that found the deadlock, so the
+ * nodes are only reported once all of them have stopped. Each one first reports the ticks up to the
+ * deadlock, as though it had simulated them.
+ * @params:
+ *   None
+ * @returns:
+ *   none
+ */
+static void print_deadlocked(void) {
+    /* A finished node's clock is already past its last tick, a deadlocked node's is still on it
+     */
+    int time = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        int after = nodes[i]->clock_time + nodes[i]->deadlocked;
+        if (after > time) {
+            time = after;
+        }
+    }
+
+    for (int i = 0; i < num_nodes; i++) {
+        processor_t *cpu = nodes[i];
+        if (cpu->deadlocked) {
+            end_tick(cpu, time);
+            trace_add(cpu, cpu->node_id, 0, EVENT_DEADLOCKED, 0);
+            cpu->settled = INT_MAX;
+        }
+    }
+}
+
+/* Write out the output every node has settled, between two phases of the simulation
+ * @params:
+ *   None
+ * @returns:
+ *   none
+ */
+static void trace_round(void) {
+    int until = INT_MAX;
+    for (int i = 0; i < num_nodes; i++) {
+        if (nodes[i]->settled < until) {
+            until = nodes[i]->settled;
+        }
+    }
+    trace_flush(until);
+}
+
+/* Perform the simulation of all nodes
+ * The nodes' ticks are run as tasks on a pool of worker threads, so there can be far more nodes than threads.
+ * The nodes only wait for each other once per lookahead window, which is every tick with the default latency.
+ * In optimistic mode they run further ahead instead, and the reduction between rounds computes GVT.
+ * In SIM_EVENT mode the nodes do no scheduling work on quiet ticks, they go straight to the next tick
+ * on which something can change on any node. The output is the same as in SIM_TICK mode.
+ * The nodes record their output as events, which are written out in order of time as the nodes settle them,
+ * so the output does not depend on how the nodes are scheduled either.
+ * @params:
+ *   num_workers: number of worker threads
+ * @returns:
+ *   returns 1
+ */
+extern int process_run(int num_workers) {
+    /* A run that only outputs the summary has nothing to write out along the way
+     */
+    workers_run((void **)nodes, num_nodes, num_workers, node_task,
+                trace_level > TRACE_NONE ? trace_round : NULL, TRACE_FLUSH_INTERVAL);
+    print_deadlocked();
+    trace_flush(INT_MAX);
+    return 1;
+}
+
+/* Determine which of two finished processes is reported first
+ * Processes are ordered by finishing time, then node id, then process id.
+ * @params:
+ *   a, b: finished processes' contexts
+ * @returns:
+ *   1 if a comes before b, 0 otherwise
+ */
+static int finished_before(context *a, context *b) {
+    if (a->finished != b->finished) {
+        return a->finished < b->finished;
+    }
+    if (a->thread != b->thread) {
+        return a->thread < b->thread;
+    }
+    return a->id < b->id;
+}
+
+/* Return a process from a node's finished log
+ * @params:
+ *   cpu : node context
+ *   next: index in the node's finished log
+ * @returns:
+ *   the finished process' context
+ */
+static context *merge_head(processor_t *cpu, int next) {
+    return *(context **)alist_get(cpu->finished, next);
+}
+
+/* Restore the heap order of the merge heap below a position
+ * @params:
+ *   heap: nodes ordered by the next finished process in their log
+ *   next: index of the next unreported process in each node's log
+ *   size: number of nodes in the heap
+ *   i   : heap position to sift down from
+ * @returns:
+ *   none
+ */
+static void merge_sift_down(processor_t **heap, int *next, int size, int i) {
+    for (;;) {
+        int first = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < size &&
+                finished_before(merge_head(heap[left], next[left]), merge_head(heap[first], next[first]))) {
+            first = left;
+        }
+        if (right < size &&
+                finished_before(merge_head(heap[right], next[right]), merge_head(heap[first], next[first]))) {
+            first = right;
+        }
+        if (first == i) {
+            return;
+        }
+
+        processor_t *cpu = heap[i];
+        heap[i] = heap[first];
+        heap[first] = cpu;
+        int pos = next[i];
+        next[i] = next[first];
+        next[first] = pos;
+        i = first;
+    }
+}
+
+/* Output process summary post execution
+ * With a binary trace the summary goes at the end of the trace instead, which finishes it.
+ * @params:
+ *   fout : output file
+ * @returns:
+ *   none
+ */
+extern void process_summary(FILE *fout) {
+    /* Each node's log is already in order, so a k-way merge of the logs gives the global order.
+     * The heap holds every node that still has unreported processes, keyed on the next one.
+     * Assume the allocations will be successful
+     */
+    processor_t **heap = calloc(num_nodes + 1, sizeof(processor_t *));
+    int *next = calloc(num_nodes + 1, sizeof(int));
+    int size = 0;
+
+    for (int i = 0; i < num_nodes; i++) {
+        if (nodes[i]->finished->currSize > 0) {
+            heap[size++] = nodes[i];
+        }
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) {
+        merge_sift_down(heap, next, size, i);
+    }
+
+    while (size > 0) {
+        context *proc = merge_head(heap[0], next[0]);
+        if (binary_trace != NULL) {
+            trace_summary summary = {proc->finished, proc->thread, proc->id,
+                                     proc->doop_time, proc->block_time, proc->wait_time};
+            trace_write_summary(binary_trace, &summary);
+        } else {
+            context_stats(proc, fout);
+        }
+
+        /* Move on to the node's next process, or drop the node once its log is done
+         */
+        next[0]++;
+        if (next[0] == heap[0]->finished->currSize) {
+            size--;
+            heap[0] = heap[size];
+            next[0] = next[size];
+        }
+        merge_sift_down(heap, next, size, 0);
+    }
+
+    free(heap);
+    free(next);
+
+    if (binary_trace != NULL) {
+        trace_writer_close(binary_trace);
+        binary_trace = NULL;
     }
 }
@@ -6,48 +6,184 @@
 #define PROSIM_PROCESS_H
 #include "context.h"
 #include "Data Structures/PriorityQueue.h"
+#include "Data Structures/TimerWheel.h"
+#include "Data Structures/ArrayList.h"
+#include "message_passing.h"
+#include "Utils/trace.h"
 
+/* How process_run advances the clock
+ * SIM_TICK runs the scheduler on every tick, SIM_EVENT jumps over ticks on which nothing can change.
+ */
+typedef enum sim_mode {
+    SIM_TICK = 0,
+    SIM_EVENT
+} sim_mode_t;
+
+/* What the simulation outputs besides the summary, each level includes the ones below it
+ * Errors are always output. Define PROSIM_TRACE_LEVEL at compile time to leave the levels above it
+ * out of the simulator altogether.
+ */
+typedef enum trace_level {
+    TRACE_NONE = 0,          /* only the summary */
+    TRACE_STATE,             /* process state changes */
+    TRACE_CLOCK,             /* the nodes' clock ticks and completion, the default */
+    TRACE_BARRIER,           /* the next event each node reports when it stops for the other nodes */
+    TRACE_QUEUE              /* processes entering and leaving the ready queue */
+} trace_level_t;
+
+#ifndef PROSIM_TRACE_LEVEL
+#define PROSIM_TRACE_LEVEL TRACE_QUEUE
+#endif
+
+/* Blocked processes are kept in a hierarchical timing wheel keyed on their wake-up time.
+ * Define PROSIM_BLOCKED_HEAP at compile time to keep them in a PriorityQueue instead.
+ */
 typedef struct processor {
+#ifdef PROSIM_BLOCKED_HEAP
     PriorityQueue *blocked;       /* queue for blocked processes on node */
+#else
+    TimerWheel *blocked;          /* wheel for blocked processes on node */
+#endif
     PriorityQueue *ready;         /* queue for blocked processes on node */
     int clock_time;          /* local node time */
     int next_proc_id;        /* local node process counter */
+    context **batch;         /* ready processes waiting to be added to the ready queue together */
+    int *batch_priority;     /* priorities of the processes in the batch */
+    int batch_size;          /* number of processes in the batch */
+    int batch_max;           /* capacity of the batch arrays */
+    ArrayList *finished;     /* pointers to processes that finished on this node, in order of completion */
+    int node_id;             /* id of the node */
+    context *cur;            /* running process or NULL */
+    int cpu_quantum;         /* what is left of the running process' quantum */
+    int next_event;          /* tick of the node's next event, INT_MAX if it has none */
+    int started;             /* set once the node has run its first tick */
+    ArrayList *procs;        /* processes admitted to this node, in order of admission */
+    int queue_seq;           /* counts processes being queued, so the queues can be rebuilt in order */
+    int done;                /* set once all processes are finished but the node still has to report to the others */
+    int quiet;               /* set once the current tick has been run and left every process waiting in a RECV
+                                with no message on the way */
+    int deadlocked;          /* set once the node is quiet and no other node can send it a message any more */
+    ArrayList *checkpoints;  /* saved states to roll back to in optimistic mode, oldest first */
+    trace_event *log;        /* output not written yet, in order of time */
+    int log_len;             /* events in the log */
+    int log_max;             /* capacity of the log */
+    long log_start;          /* events of the log that have been written out and removed */
+    int committed;           /* ticks before this can no longer be rolled back, in optimistic mode */
+    int settled;             /* the node's output before this tick is final, INT_MAX once the node is finished */
+    mailbox *mailbox;        /* messages sent to processes on this node */
+    ArrayList *inbox;        /* messages just taken out of the mailbox */
+    channel_table *channels; /* messages delivered to the node, and in optimistic mode the received ones until GVT passes */
+    ArrayList *handed;       /* processes waiting in a RECV whose message is on the way, by arrival */
+    int receiving;           /* number of processes waiting in a RECV */
+    ArrayList *sent;         /* messages sent by the node that a rollback may have to cancel, in optimistic mode */
+    unsigned long next_msg_id;   /* numbers the messages sent by the node */
+    int sent_min;            /* earliest arrival of the messages sent since the node last reported its next event */
 } processor_t;
 
 /* Initialize the simulation
  * @params:
  *   quantum: the CPU quantum to use in the situation
+ *   mode   : how process_run advances the clock
+ *   latency: minimum number of ticks a message takes between nodes, at least 1
+ *   ahead  : if positive, run optimistically with nodes going up to this many ticks past GVT between GVT rounds
  * @returns:
  *   returns 1
  */
-extern void process_init(int cpu_quantum);
+extern void process_init(int cpu_quantum, sim_mode_t mode, int latency, int ahead);
+
+/* Choose what the simulation outputs
+ * @params:
+ *   level: how much to output
+ *   node : if positive, only output what happens on this node
+ *   pid  : if positive, only output what happens to the processes with this id, along with their nodes' clock ticks
+ * @returns:
+ *   none
+ */
+extern void process_trace(trace_level_t level, int node, int pid);
+
+/* Write the output to a binary trace instead of stdout
+ * The trace is much smaller and cheaper to write than the text, which trace_text turns it back into.
+ * @params:
+ *   fout    : file to write the trace to
+ *   compress: if true, compress the trace
+ * @returns:
+ *   none
+ */
+extern void process_binary_trace(FILE *fout, int compress);
 
 /* Create a new node context
  * @params:
- *   None
+ *   node_id: id of the node
  * @returns:
  *   pointer to new node context.
  */
-extern processor_t *process_new();
+extern processor_t *process_new(int node_id);
+
+/* Register a process with a node before it is admitted
+ * Gives the process its id and lists it in the process directory that messages are routed through.
+ * Admitting a process registers it if this has not been done, but processes that are sent messages
+ * at admission have to be registered before any process is admitted.
+ * @params:
+ *   cpu : node context
+ *   proc: pointer to the program context of the process
+ * @returns:
+ *   1 if the process is in the directory, 0 if its address is taken or the directory could not grow
+ */
+extern int process_register(processor_t *cpu, context *proc);
 
 /* Admit a process into the simulation
  * @params:
  *   proc: pointer to the program context of the process to be admitted
  *   cpu : node context
  * @returns:
- *   returns 1
+ *   1 if the process was admitted, 0 if it could not be registered
  */
 extern int process_admit(processor_t *cpu, context *proc);
 
-/* Perform the simulation
+/* Admit a group of processes into the simulation
+ * Equivalent to admitting them one at a time in array order, but the ready ones
+ * are added to the ready queue in a single batch.
+ * @params:
+ *   cpu  : node context
+ *   procs: array of pointers to the program contexts of the processes to be admitted
+ *   num_procs: number of processes in the array
+ * @returns:
+ *   returns 1
+ */
+extern int process_admit_batch(processor_t *cpu, context **procs, int num_procs);
+
+/* Simulate a window of clock ticks of a node
+ * Finishes the previous window, then runs the node up to the lookahead without waiting for the other nodes.
+ * Every node must finish a window before any node starts the next one.
  * @params:
  *   cpu : node context
+ *   global: the earliest next event reported by any node for the previous window
+ *   next: set to the node's next event after the window
+ * @returns:
+ *   1 if the node needs to run again, 0 once all its processes are finished
+ */
+extern int process_tick(processor_t *cpu, int global, int *next);
+
+/* Roll a node back to the state it had at an earlier tick
+ * Only possible in optimistic mode, and no further back than the last GVT.
+ * @params:
+ *   cpu : node context
+ *   time: the tick that has to be simulated again
+ * @returns:
+ *   1 if the node was rolled back, 0 if it has no state that old
+ */
+extern int process_rollback(processor_t *cpu, int time);
+
+/* Perform the simulation of all nodes
+ * @params:
+ *   num_workers: number of worker threads
  * @returns:
  *   returns 1
  */
-extern int process_simulate(processor_t *cpu, int thread_id);
+extern int process_run(int num_workers);
 
 /* Output process summary post execution
+ * With a binary trace the summary goes at the end of the trace instead, which finishes it.
  * @params:
  *   fout : output file
  * @returns:
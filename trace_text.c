@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "Utils/trace.h"
+
+/* Turn a binary trace written by prosim -b back into the text prosim outputs
+ * Build it with Utils/trace.c.
+ * @params:
+ *   argc, argv: the trace file, the trace comes from stdin if there is none
+ * @returns:
+ *   0, or -1 if the trace cannot be read
+ */
+int main(int argc, char **argv) {
+    FILE *fin = stdin;
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [trace]\n", argv[0]);
+        return -1;
+    }
+    if (argc == 2) {
+        fin = fopen(argv[1], "rb");
+        if (!fin) {
+            fprintf(stderr, "Could not open trace file %s\n", argv[1]);
+            return -1;
+        }
+    }
+
+    trace_reader *reader = trace_reader_new(fin);
+    if (!reader) {
+        fprintf(stderr, "Bad input, not a trace of version %d\n", TRACE_VERSION);
+        return -1;
+    }
+
+    /* Lines are gathered in a buffer and written out whenever it fills up
+     */
+    static char buffer[65536];
+    char *end = buffer;
+    trace_event event;
+    trace_summary summary;
+    int result;
+    while ((result = trace_read(reader, &event, &summary)) > TRACE_READ_END) {
+        if (end - buffer > (int)sizeof(buffer) - TRACE_LINE_MAX) {
+            fwrite(buffer, 1, end - buffer, stdout);
+            end = buffer;
+        }
+        if (result == TRACE_READ_EVENT) {
+            end = trace_format(&event, end);
+        } else {
+            end = trace_format_summary(&summary, end);
+        }
+    }
+    fwrite(buffer, 1, end - buffer, stdout);
+    trace_reader_close(reader);
+
+    if (result == TRACE_READ_ERROR) {
+        fprintf(stderr, "Bad input, trace is damaged or cut short\n");
+        return -1;
+    }
+    return 0;
+}